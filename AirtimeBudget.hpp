@@ -0,0 +1,196 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief ARIB STD-T108 の送信時間総和制限(1時間あたり360秒)を管理する
+/// @details SKSENDTO毎に送信時間を見積もって1時間のスライディングウィンドウに積算し、
+///          S-レジスタ0xFD(累積送信時間)の読み出し値で定期的に補正する。
+///          時刻はミリ秒単位の単調増加カウンタ(オーバーフロー可)で与える。
+class AirtimeBudget {
+  public:
+    static constexpr uint32_t windowMs       = 3600UL * 1000UL;
+    static constexpr size_t bucketCount      = 60;
+    static constexpr uint32_t bucketMs       = windowMs / bucketCount;
+    static constexpr uint32_t bitsPerMs      = 100; // 920MHz帯 100kbps
+    static constexpr size_t frameOverhead    = 60;  // SHR/PHR + MACヘッダ + 暗号化 + 6LoWPAN/UDP + FCS
+    static constexpr size_t ackFrameBytes    = 17;  // 応答フレームに対してモジュールが返すACK
+    static constexpr uint32_t defaultLimitMs = 360UL * 1000UL;
+
+    /// @brief ペイロード長からSKSENDTO 1回分の送信時間[ms]を見積もる
+    static uint32_t estimateAirtimeMs(const size_t payloadBytes) {
+        const uint32_t bits = static_cast<uint32_t>((payloadBytes + frameOverhead + ackFrameBytes) * 8);
+        return (bits + bitsPerMs - 1) / bitsPerMs;
+    }
+
+    /// @param limitMs ウィンドウ内で許容する送信時間
+    /// @param marginMs 見積もり誤差に備えて残しておく余裕
+    void setLimit(const uint32_t limitMs, const uint32_t marginMs) {
+        this->limitMs  = limitMs;
+        this->marginMs = marginMs < limitMs ? marginMs : limitMs;
+    }
+
+    void setReconcileInterval(const uint32_t intervalMs) {
+        this->reconcileIntervalMs = intervalMs;
+    }
+
+    void record(const uint32_t now, const uint32_t airtimeMs) {
+        advance(now);
+        buckets[head] += airtimeMs;
+        estimatedSinceReconcile += airtimeMs;
+    }
+
+    uint32_t used(const uint32_t now) {
+        advance(now);
+        uint32_t sum = 0;
+        for (const uint32_t b : buckets) {
+            sum += b;
+        }
+        return sum;
+    }
+
+    uint32_t remaining(const uint32_t now) {
+        const uint32_t budget = limitMs - marginMs;
+        const uint32_t u      = used(now);
+        return u < budget ? budget - u : 0;
+    }
+
+    bool canSend(const uint32_t now, const size_t payloadBytes) {
+        if (blocked) {
+            return false;
+        }
+        return estimateAirtimeMs(payloadBytes) <= remaining(now);
+    }
+
+    /// @brief 送信可能になるまでの待ち時間[ms]。ウィンドウから古い送信が抜けるのを待つ
+    uint32_t waitTime(const uint32_t now, const size_t payloadBytes) {
+        if (canSend(now, payloadBytes)) {
+            return 0;
+        }
+        if (blocked) {
+            return bucketMs;
+        }
+        const uint32_t budget = limitMs - marginMs;
+        const uint32_t need   = estimateAirtimeMs(payloadBytes);
+        uint32_t u            = used(now);
+        uint32_t wait         = bucketMs - (now - headStart);
+        for (size_t i = 1; i <= bucketCount; i++) {
+            u -= buckets[(head + i) % bucketCount];
+            if (u + need <= budget) {
+                return wait;
+            }
+            wait += bucketMs;
+        }
+        return windowMs;
+    }
+
+    /// @brief 1リクエスト当たりpayloadBytesの送信を継続できる最短間隔[ms]
+    uint32_t sustainableIntervalMs(const size_t payloadBytes) const {
+        const uint32_t budget = limitMs - marginMs;
+        if (budget == 0) {
+            return windowMs;
+        }
+        return static_cast<uint32_t>(static_cast<uint64_t>(windowMs) * estimateAirtimeMs(payloadBytes) / budget);
+    }
+
+    bool reconcileDue(const uint32_t now) const {
+        return !reconcileAttempted || now - lastReconcile >= reconcileIntervalMs;
+    }
+
+    /// @brief 累積送信時間を読み出せなかったので次の補正まで見積もりのまま運用する
+    void deferReconcile(const uint32_t now) {
+        reconcileAttempted = true;
+        lastReconcile      = now;
+    }
+
+    /// @brief モジュールの累積送信時間で見積もりを補正する
+    void reconcile(const uint32_t now, const uint32_t moduleCumulativeMs) {
+        advance(now);
+        if (reconciled) {
+            // モジュールがリセットされていれば累積値は0から数え直している
+            const uint32_t actual = moduleCumulativeMs >= lastModuleCumulative ? moduleCumulativeMs - lastModuleCumulative : moduleCumulativeMs;
+            if (actual >= estimatedSinceReconcile) {
+                buckets[head] += actual - estimatedSinceReconcile;
+            } else {
+                uint32_t excess = estimatedSinceReconcile - actual;
+                for (size_t i = 0; i < bucketCount && excess > 0; i++) {
+                    uint32_t &b       = buckets[(head + bucketCount - i) % bucketCount];
+                    const uint32_t dt = b < excess ? b : excess;
+                    b -= dt;
+                    excess -= dt;
+                }
+            }
+            lastError = static_cast<int32_t>(actual - estimatedSinceReconcile);
+        }
+        reconciled              = true;
+        reconcileAttempted      = true;
+        lastReconcile           = now;
+        lastModuleCumulative    = moduleCumulativeMs;
+        estimatedSinceReconcile = 0;
+        reconcileCount++;
+    }
+
+    /// @brief EVENT 32 : 見積もりが甘かったのでウィンドウを使い切った扱いにする
+    void onLimitReached(const uint32_t now) {
+        const uint32_t u = used(now);
+        if (u < limitMs) {
+            buckets[head] += limitMs - u;
+        }
+        blocked = true;
+        limitReachedCount++;
+    }
+
+    /// @brief EVENT 33
+    void onLimitReleased() {
+        blocked = false;
+    }
+
+    bool isBlocked() const {
+        return blocked;
+    }
+
+    uint32_t getReconcileCount() const {
+        return reconcileCount;
+    }
+    uint32_t getLimitReachedCount() const {
+        return limitReachedCount;
+    }
+    int32_t getLastReconcileError() const {
+        return lastError;
+    }
+
+  private:
+    void advance(const uint32_t now) {
+        if (!started) {
+            started   = true;
+            headStart = now;
+            return;
+        }
+        for (size_t i = 0; now - headStart >= bucketMs; i++) {
+            if (i >= bucketCount) {
+                headStart = now;
+                break;
+            }
+            headStart += bucketMs;
+            head          = (head + 1) % bucketCount;
+            buckets[head] = 0;
+        }
+    }
+
+    uint32_t buckets[bucketCount]    = {0};
+    size_t head                      = 0;
+    uint32_t headStart               = 0;
+    bool started                     = false;
+    bool blocked                     = false;
+    uint32_t limitMs                 = defaultLimitMs;
+    uint32_t marginMs                = defaultLimitMs / 10;
+    uint32_t reconcileIntervalMs     = 60UL * 1000UL;
+    bool reconciled                  = false;
+    bool reconcileAttempted          = false;
+    uint32_t lastReconcile           = 0;
+    uint32_t lastModuleCumulative    = 0;
+    uint32_t estimatedSinceReconcile = 0;
+    int32_t lastError                = 0;
+    uint32_t reconcileCount          = 0;
+    uint32_t limitReachedCount       = 0;
+};
@@ -2,24 +2,175 @@
 #include "SkSendTo.hpp"
 #include <algorithm>
 #include <cstring>
+#include <esp_timer.h>
 
-#define EXPEXT_OK(receiveOk, notReceivedOk) [this](const std::string &line, const StateMachineCallback_t callback) { return line.find("OK") != std::string::npos ? receiveOk : notReceivedOk; }
+#define EXPEXT_OK(waiting, receiveOk, notReceivedOk) [this](const SkLine &line, const StateMachineCallback_t callback) { return line.type == SkLine::Type::Ok ? receiveOk : line.isAsync() ? waiting : notReceivedOk; }
 #define DECLARE_STATE(_state, _read) .state = _state, .read = _read
+#define DECLARE_TIMED_STATE(_state) .state = _state, .read = false, .timed = true
+#define DECLARE_STATE_WITH_TIMEOUT(_state, _read, _timeout, _timeoutState) .state = _state, .read = _read, .timeout = _timeout, .timeoutState = _timeoutState
+
+static uint32_t nowMillis() {
+    return static_cast<uint32_t>(esp_timer_get_time() / 1000);
+}
+
+/// @brief UART速度をWUARTの設定値に変換する
+/// @return 対応していない速度の場合は-1
+static int uartMode(const uint32_t baudRate) {
+    constexpr uint32_t baudRates[] = {115200, 2400, 4800, 9600, 19200, 38400, 57600};
+    for (size_t i = 0; i < sizeof(baudRates) / sizeof(baudRates[0]); i++) {
+        if (baudRates[i] == baudRate) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+/// @brief MACアドレス(64bit)からIPv6リンクローカルアドレスを求める(SKLL64と同じ変換)
+/// @details EUI-64のU/Lビットを反転してインターフェースIDとし、FE80::/64 に続ける
+/// @return MACアドレスが16桁の16進数でない場合はfalse
+static bool linkLocalAddress(const std::string &macAddress, std::string *const ipv6Address) {
+    if (macAddress.length() != 16) {
+        return false;
+    }
+    uint8_t eui64[8];
+    for (size_t i = 0; i < sizeof(eui64); i++) {
+        uint8_t byte = 0;
+        for (size_t j = 0; j < 2; j++) {
+            const char c = macAddress[i * 2 + j];
+            if (c >= '0' && c <= '9') {
+                byte = (byte << 4) | (c - '0');
+            } else if (c >= 'A' && c <= 'F') {
+                byte = (byte << 4) | (c - 'A' + 10);
+            } else if (c >= 'a' && c <= 'f') {
+                byte = (byte << 4) | (c - 'a' + 10);
+            } else {
+                return false;
+            }
+        }
+        eui64[i] = byte;
+    }
+    eui64[0] ^= 0x02;
+    char s[40];
+    snprintf(s, sizeof(s), "FE80:0000:0000:0000:%02X%02X:%02X%02X:%02X%02X:%02X%02X", eui64[0], eui64[1], eui64[2], eui64[3], eui64[4], eui64[5], eui64[6], eui64[7]);
+    ipv6Address->assign(s);
+    return true;
+}
+
+/// @brief デコード済みのバイナリを受け取るload()があれば、データ部を再デコードせずに渡す
+template <class Frame>
+static auto loadFrame(Frame *const frame, const ErxUdp &, const std::vector<uint8_t> &data, int) -> decltype(frame->load(data.data(), data.size())) {
+    return frame->load(data.data(), data.size());
+}
+
+/// @brief 16進文字列だけを受け取るload()の場合はデータ部の文字列を渡す
+template <class Frame>
+static bool loadFrame(Frame *const frame, const ErxUdp &erxUdp, const std::vector<uint8_t> &, long) {
+    return frame->load(erxUdp.payload.c_str());
+}
+
+/// @brief ERXUDPのデータ部をECHONET Liteの電文として読み込む
+template <class Frame>
+static bool loadFrame(Frame *const frame, const ErxUdp &erxUdp, const std::vector<uint8_t> &data) {
+    return loadFrame(frame, erxUdp, data, 0);
+}
+
+/// @brief 受信した電文が送信中の要求(Get)への応答か
+/// @details ESVがGet_Res(0x72)かGet_SNA(0x52)で、TIDが要求と一致するものだけを応答とする。
+///          INF(0x73)の通知や、以前の要求への遅れた応答は含まない
+static bool isResponseTo(const std::vector<uint8_t> &frame, const std::vector<uint8_t> &request) {
+    // EHD1 EHD2 TID(2) SEOJ(3) DEOJ(3) ESV OPC (EPC PDC EDT)...
+    constexpr size_t tidOffset = 2;
+    constexpr size_t esvOffset = 10;
+    if (frame.size() < esvOffset + 2 || request.size() < tidOffset + 2) {
+        return false;
+    }
+    const uint8_t esv = frame[esvOffset];
+    return (esv == 0x72 || esv == 0x52) && frame[tidOffset] == request[tidOffset] && frame[tidOffset + 1] == request[tidOffset + 1];
+}
+
+/// @brief Get_SNA(0x52)応答で値が得られなかった(PDC=0の)EPCを取り出す
+/// @return Get_SNA応答の場合はtrue
+static bool findMissingProperties(const std::vector<uint8_t> &frame, std::vector<uint8_t> *const missing) {
+    // EHD1 EHD2 TID(2) SEOJ(3) DEOJ(3) ESV OPC (EPC PDC EDT)...
+    constexpr size_t esvOffset = 10;
+    constexpr uint8_t getSna   = 0x52;
+    missing->clear();
+    if (frame.size() < esvOffset + 2 || frame[esvOffset] != getSna) {
+        return false;
+    }
+    const uint8_t opc = frame[esvOffset + 1];
+    size_t pos        = esvOffset + 2;
+    for (uint8_t i = 0; i < opc && pos + 1 < frame.size(); i++) {
+        if (frame[pos + 1] == 0) {
+            missing->push_back(frame[pos]);
+        }
+        pos += 2 + frame[pos + 1];
+    }
+    return true;
+}
 
 template <class StateType>
-StateType BP35A1::checkSuccessUdpSend(const std::string &line, const StateType success, const StateType failed) {
-    if (line.find("OK") != std::string::npos) {
+StateType BP35A1::checkSuccessUdpSend(const SkLine &line, const StateType success, const StateType waiting, const StateType retry, const StateType giveUp) {
+    if (line.type == SkLine::Type::Ok) {
         udpSendReceivedOk = true;
+    } else if (line.type == SkLine::Type::Fail) {
+        udpSendReceivedOk = udpSendReceivedComplete = false;
+        if (SkCommandResult::isBusyError(line.errorCode) && udpSendRequest.attempts < udpSendMaxAttempts) {
+            metrics.increment(Metrics::Counter::CommandBusyRetries);
+            ESP_LOGD(TAG, "SKSENDTO busy (ER%02u), resend immediately", line.errorCode);
+            udpSendRequest.retryAt = nowMillis();
+            return retry;
+        }
+        if (SkCommandResult::isRejectError(line.errorCode)) {
+            metrics.increment(Metrics::Counter::CommandRejections);
+        }
+        metrics.increment(Metrics::Counter::UdpSendFailures);
+        ESP_LOGW(TAG, "SKSENDTO failed (ER%02u), give up", line.errorCode);
+        if (udpSendFailedCallback != nullptr) {
+            udpSendFailedCallback(udpSendRequest.attempts);
+        }
+        return giveUp;
     } else {
-        const Event event = Event(line.c_str(), line.length());
-        ESP_LOGI(TAG, "Receive Event : %02X", event.type);
-        switch (event.type) {
+        ESP_LOGI(TAG, "Receive Event : %02X", (unsigned)line.eventType);
+        switch (line.eventType) {
             case Event::Type::CompleteUdpSending:
+                if (line.eventParameter == Event::Parameter::FailedUdpSend) {
+                    udpSendReceivedOk = udpSendReceivedComplete = false;
+                    linkQuality.addSendResult(false);
+                    if (udpSendRequest.attempts >= udpSendMaxAttempts) {
+                        metrics.increment(Metrics::Counter::UdpSendFailures);
+                        ESP_LOGW(TAG, "UDP send failed %u times, give up", udpSendRequest.attempts);
+                        if (udpSendFailedCallback != nullptr) {
+                            udpSendFailedCallback(udpSendRequest.attempts);
+                        }
+                        return giveUp;
+                    }
+                    // 64bitで計算し、シフト量も抑えて桁あふれしないようにする(maxAttemptsは利用者が設定できる)
+                    const uint32_t shift   = std::min<uint32_t>(udpSendRequest.attempts > 0 ? udpSendRequest.attempts - 1 : 0, 31);
+                    const uint32_t backoff = static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(udpSendBackoffMs) << shift, udpSendBackoffMaxMs));
+                    udpSendRequest.retryAt = nowMillis() + backoff;
+                    ESP_LOGD(TAG, "Failed Send UDP (attempt %u), retry after %u ms", udpSendRequest.attempts, backoff);
+                    return retry;
+                }
+                if (line.eventParameter == Event::Parameter::NeighborSolicitation) {
+                    ESP_LOGD(TAG, "Neighbor Solicitation in progress... continue");
+                    break;
+                }
                 ESP_LOGD(TAG, "Success Send UDP");
+                linkQuality.addSendResult(true);
                 udpSendReceivedComplete = true;
                 break;
+            case Event::Type::ErrorARIB108SendingTime:
+                udpSendReceivedOk = udpSendReceivedComplete = false;
+                metrics.increment(Metrics::Counter::UdpSendFailures);
+                ESP_LOGW(TAG, "UDP send refused by ARIB STD-T108 sending time limit");
+                if (udpSendFailedCallback != nullptr) {
+                    udpSendFailedCallback(udpSendRequest.attempts);
+                }
+                return giveUp;
             default:
                 ESP_LOGD(TAG, "Unexpected Event... continue");
+                this->metrics.increment(Metrics::Counter::UnexpectedLines);
                 break;
         }
     }
@@ -27,10 +178,20 @@ StateType BP35A1::checkSuccessUdpSend(const std::string &line, const StateType s
         udpSendReceivedOk = udpSendReceivedComplete = false;
         return success;
     } else {
-        return failed;
+        return waiting;
     }
 }
 
+template <class StateType>
+StateType BP35A1::retryUdpSend(const StateType retry, const StateType waiting) {
+    if (static_cast<int32_t>(nowMillis() - udpSendRequest.retryAt) < 0) {
+        return retry;
+    }
+    metrics.increment(Metrics::Counter::UdpSendRetries);
+    transmitUdpData();
+    return waiting;
+}
+
 template <class StateType>
 const BP35A1::StateMachine<StateType> *BP35A1::findStateMachine(const std::vector<BP35A1::StateMachine<StateType>> *const stateMachines, const StateType state) {
     for (const auto &machine : *stateMachines)
@@ -42,191 +203,312 @@ const BP35A1::StateMachine<StateType> *BP35A1::findStateMachine(const std::vecto
 void BP35A1::buildStateMachine() {
     comm_state_machines_ = std::vector<StateMachine<CommunicationState>>{
         {
-            DECLARE_STATE(CommunicationState::waitSuccessUdpSend, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return checkSuccessUdpSend(line, CommunicationState::waitErxudp, CommunicationState::waitSuccessUdpSend);
+            DECLARE_STATE_WITH_TIMEOUT(CommunicationState::waitSuccessUdpSend, true, 10000, CommunicationState::ready),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                return checkSuccessUdpSend(line, CommunicationState::waitErxudp, CommunicationState::waitSuccessUdpSend, CommunicationState::waitRetryUdpSend, CommunicationState::ready);
+            },
+        },
+        {
+            DECLARE_TIMED_STATE(CommunicationState::waitRetryUdpSend),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                return retryUdpSend(CommunicationState::waitRetryUdpSend, CommunicationState::waitSuccessUdpSend);
             },
         },
         {
-            DECLARE_STATE(CommunicationState::waitErxudp, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                if (line.find("ERXUDP " + this->CommunicationParameter.ipv6Address) != std::string::npos) {
-                    const std::string payload = ErxUdp(line).payload;
-                    if (callback != nullptr && !payload.empty() && this->echonet.load(payload.c_str())) {
-                        callback(this->echonet);
+            DECLARE_STATE_WITH_TIMEOUT(CommunicationState::waitErxudp, true, 10000, CommunicationState::ready),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (this->isErxUdpFromMeter(line)) {
+                    if (!this->erxUdp.parse(line.text()) || !this->erxUdp.decodePayload(this->erxUdpData)) {
+                        ESP_LOGW(TAG, "Invalid ERXUDP payload (length %u)", this->erxUdp.length);
+                    } else if (!isResponseTo(this->erxUdpData, this->udpSendRequest.data)) {
+                        ESP_LOGD(TAG, "ERXUDP is not the response to the pending request... continue");
+                        this->metrics.increment(Metrics::Counter::UnexpectedLines);
+                        return CommunicationState::waitErxudp;
+                    } else if (loadFrame(&this->echonet, this->erxUdp, this->erxUdpData)) {
+                        this->linkQuality.addResponseLatency(nowMillis() - this->udpSendRequest.sentAt);
+                        this->udpSendRequest.answered = true;
+                        if (findMissingProperties(this->erxUdpData, &this->missingProperties)) {
+                            this->metrics.increment(Metrics::Counter::PartialResponses);
+                            ESP_LOGD(TAG, "Partial response, %u properties missing", (unsigned)this->missingProperties.size());
+                        }
+                        this->dispatchProperties();
+                        if (callback != nullptr) {
+                            callback(this->echonet);
+                        }
+                        // 得られなかったEPCだけを問い合わせ直す
+                        const uint8_t retries = this->partialResponseRetries;
+                        if (!this->missingProperties.empty() && retries < this->maxPartialResponseRetries) {
+                            this->requestEpcs.assign(this->missingProperties.begin(), this->missingProperties.end());
+                            if (this->sendPropertyRequest(this->requestEpcs)) {
+                                this->partialResponseRetries  = retries + 1;
+                                this->udpSendRequest.answered = true;
+                                return CommunicationState::waitSuccessUdpSend;
+                            }
+                        }
                     } else {
                         ESP_LOGD(TAG, "load() failed or empty payload for ERXUDP response");
                     }
                     return CommunicationState::ready;
                 } else {
                     ESP_LOGD(TAG, "Unexpected Event... continue");
+                    this->metrics.increment(Metrics::Counter::UnexpectedLines);
                     return CommunicationState::waitErxudp;
                 }
             },
         },
-    };
-
-    init_state_machines_ = std::vector<StateMachine<InitializeState>>{
         {
-            DECLARE_STATE(InitializeState::uninitialized, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::terminateSKStack) > 0 ? InitializeState::waitSKTermEchoBack : InitializeState::uninitialized;
+            DECLARE_STATE(CommunicationState::edScan, false),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                char s[16];
+                snprintf(s, sizeof(s), "%d %08X %X", (uint8_t)ScanMode::EDScan, (unsigned)this->scanChannelMask, 4U);
+                const std::string arg = std::string(s);
+                this->lastEdScan      = nowMillis();
+                this->linkQuality.beginEdScan();
+                return this->execCommand(SKCmd::scanSKStack, &arg) > 0 ? CommunicationState::waitEdScanOk : CommunicationState::ready;
             },
         },
+        {DECLARE_STATE_WITH_TIMEOUT(CommunicationState::waitEdScanOk, true, 5000, CommunicationState::ready), .processor = EXPEXT_OK(CommunicationState::waitEdScanOk, CommunicationState::waitEdScanResult, CommunicationState::ready)},
         {
-            DECLARE_STATE(InitializeState::waitSKTermEchoBack, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return InitializeState::resetSKStack;
+            DECLARE_STATE_WITH_TIMEOUT(CommunicationState::waitEdScanResult, true, 10000, CommunicationState::ready),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                return line.type == SkLine::Type::Eedscan ? CommunicationState::waitEdScanChannels : CommunicationState::waitEdScanResult;
             },
         },
         {
-            DECLARE_STATE(InitializeState::resetSKStack, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::resetSKStack) > 0 ? InitializeState::waitResetSKStackEchoBack : InitializeState::resetSKStack;
+            DECLARE_STATE_WITH_TIMEOUT(CommunicationState::waitEdScanChannels, true, 5000, CommunicationState::ready),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                // チャンネルとRSSIの組が並ぶ
+                const char *p   = line.text().c_str();
+                size_t channels = 0;
+                while (true) {
+                    char *end;
+                    const unsigned long channel = strtoul(p, &end, 16);
+                    if (end == p) {
+                        break;
+                    }
+                    const char *const next     = end;
+                    const unsigned long energy = strtoul(next, &end, 16);
+                    if (end == next) {
+                        break;
+                    }
+                    p = end;
+                    this->linkQuality.addChannelEnergy(static_cast<uint8_t>(channel), static_cast<uint8_t>(energy));
+                    channels++;
+                }
+                if (channels == 0 || *p != '\0') {
+                    ESP_LOGW(TAG, "Invalid ED scan result, discard");
+                    this->linkQuality.abandonEdScan();
+                    return CommunicationState::ready;
+                }
+                this->linkQuality.completeEdScan();
+                if (this->linkQuality.isDegraded()) {
+                    this->reselectChannel();
+                }
+                return CommunicationState::ready;
             },
         },
         {
-            DECLARE_STATE(InitializeState::waitResetSKStackEchoBack, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return InitializeState::disableEcho;
+            DECLARE_STATE(CommunicationState::enterSleep, false),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                this->pendingCommand = this->submitCommand(this->makeCommand(SKCmd::deepSleep));
+                return CommunicationState::waitSleepOk;
             },
         },
         {
-            DECLARE_STATE(InitializeState::disableEcho, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::disableEcho) > 0 ? InitializeState::waitDisableEcho : InitializeState::disableEcho;
+            DECLARE_TIMED_STATE(CommunicationState::waitSleepOk),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (this->pendingCommand == nullptr || !this->pendingCommand->ready()) {
+                    return CommunicationState::waitSleepOk;
+                }
+                if (!this->pendingCommand->ok()) {
+                    ESP_LOGW(TAG, "SKDSLEEP failed (ER%02u), deep sleep disabled", this->pendingCommand->errorCode);
+                    this->deepSleepEnabled = false;
+                    return CommunicationState::ready;
+                }
+                ESP_LOGD(TAG, "Module entered deep sleep, next poll in %u ms", (unsigned)this->pollScheduler.nextReleaseIn(nowMillis()));
+                this->metrics.increment(Metrics::Counter::DeepSleeps);
+                return CommunicationState::sleeping;
             },
         },
         {
-            DECLARE_STATE(InitializeState::waitDisableEcho, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                if (line.find("SKSREG") != std::string::npos) {
-                    disableEchoReceivedEcho = true;
-                }
-                if (line.find("OK") != std::string::npos) {
-                    disableEchoReceivedOk = true;
-                }
-                if (disableEchoReceivedEcho && disableEchoReceivedOk) {
-                    disableEchoReceivedEcho = disableEchoReceivedOk = false;
-                    return InitializeState::getSKInfo;
-                } else {
-                    return InitializeState::waitDisableEcho;
+            DECLARE_TIMED_STATE(CommunicationState::sleeping),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                const bool posted = this->postedRequest.count > 0 || this->postedRequests.pop(this->postedRequest);
+                if (!this->wakeRequested && !posted && this->pollScheduler.nextReleaseIn(nowMillis()) > this->wakeLeadMs) {
+                    return CommunicationState::sleeping;
                 }
+                this->wakeRequested = false;
+                this->wakeStartedAt = nowMillis();
+                this->wakeAttempts  = 0;
+                return CommunicationState::wake;
             },
         },
         {
-            DECLARE_STATE(InitializeState::getSKInfo, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::getSkInfo) > 0 ? InitializeState::waitEinfo : InitializeState::uninitialized;
+            DECLARE_TIMED_STATE(CommunicationState::wake),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                // UARTの受信で起床する。起床するまでに受信した文字は捨てられるため改行だけ送る
+                this->serial_.print("\r\n");
+                this->serial_.flush();
+                this->wakeSignalAt = nowMillis();
+                this->wakeAttempts++;
+                return CommunicationState::waitWakeSettle;
             },
         },
         {
-            DECLARE_STATE(InitializeState::waitEinfo, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::vector<std::string> tokens = splitString(line, ' ');
-                if (tokens.size() == 6 && tokens[0] == "EINFO") {
-                    this->skinfo.ipv6Address  = tokens[1];
-                    this->skinfo.macAddress64 = tokens[2];
-                    this->skinfo.channel      = tokens[3];
-                    this->skinfo.panId        = tokens[4];
-                    this->skinfo.macAddress16 = tokens[5];
-                    ESP_LOGI(TAG, "ipv6Address  : %s", this->skinfo.ipv6Address.c_str());
-                    ESP_LOGI(TAG, "macAddress64 : %s", this->skinfo.macAddress64.c_str());
-                    ESP_LOGI(TAG, "channel      : %s", this->skinfo.channel.c_str());
-                    ESP_LOGI(TAG, "panId        : %s", this->skinfo.panId.c_str());
-                    ESP_LOGI(TAG, "macAddress16 : %s", this->skinfo.macAddress16.c_str());
-                    return InitializeState::waitEinfoOk;
-                } else {
-                    ESP_LOGE(TAG, "Unexpected tokens : %d / [0] : %s", (int)tokens.size(), tokens[0].c_str());
-                    return InitializeState::uninitialized;
+            DECLARE_TIMED_STATE(CommunicationState::waitWakeSettle),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (nowMillis() - this->wakeSignalAt < wakeSettleMs) {
+                    return CommunicationState::waitWakeSettle;
                 }
+                this->pendingCommand = this->submitCommand(this->makeCommand(SKCmd::getSkInfo));
+                return CommunicationState::waitWakeInfo;
             },
         },
-        {DECLARE_STATE(InitializeState::waitEinfoOk, true), .processor = EXPEXT_OK(InitializeState::getSKStackVersion, InitializeState::uninitialized)},
         {
-            DECLARE_STATE(InitializeState::getSKStackVersion, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::getSKStackVersion) > 0 ? InitializeState::waitEver : InitializeState::uninitialized;
+            DECLARE_TIMED_STATE(CommunicationState::waitWakeInfo),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (this->pendingCommand == nullptr || !this->pendingCommand->ready()) {
+                    return CommunicationState::waitWakeInfo;
+                }
+                if (!this->pendingCommand->ok()) {
+                    if (this->wakeAttempts < maxWakeAttempts) {
+                        ESP_LOGD(TAG, "No answer after wake up (attempt %u), retry", this->wakeAttempts);
+                        return CommunicationState::wake;
+                    }
+                    ESP_LOGW(TAG, "Module did not wake up, reinitialize");
+                    this->setInitializeState(InitializeState::uninitialized);
+                    return CommunicationState::ready;
+                }
+                for (const std::string &response : this->pendingCommand->lines) {
+                    const SkLine einfo(response);
+                    if (einfo.type == SkLine::Type::Einfo && einfo.tokenCount == 5) {
+                        if (einfo.tokens[2] != this->CommunicationParameter.channel || einfo.tokens[3] != this->CommunicationParameter.panId) {
+                            ESP_LOGW(TAG, "Session lost during deep sleep (channel %s, Pan ID %s), reinitialize", einfo.tokens[2].str().c_str(), einfo.tokens[3].str().c_str());
+                            this->setInitializeState(InitializeState::uninitialized);
+                            return CommunicationState::ready;
+                        }
+                        break;
+                    }
+                }
+                this->wakeLatency.add(static_cast<float>(nowMillis() - this->wakeStartedAt), 0.2f);
+                ESP_LOGD(TAG, "Module woke up in %u ms", (unsigned)(nowMillis() - this->wakeStartedAt));
+                return CommunicationState::ready;
             },
         },
+    };
+
+    init_state_machines_ = std::vector<StateMachine<InitializeState>>{
         {
-            DECLARE_STATE(InitializeState::waitEver, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::vector<std::string> tokens = splitString(line, ' ');
-                if (tokens.size() == 2 && tokens[0] == "EVER") {
-                    this->eVer = tokens[1];
-                    ESP_LOGI(TAG, "EVER : %s", this->eVer.c_str());
-                    return InitializeState::waitEverOk;
-                } else {
-                    ESP_LOGE(TAG, "Unexpected tokens : %d / [0] : %s", (int)tokens.size(), tokens[0].c_str());
-                    return InitializeState::uninitialized;
+            DECLARE_STATE(InitializeState::uninitialized, false),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                this->warmAttaching = false;
+                if (this->warmAttachPending) {
+                    this->warmAttachPending = false;
+                    return this->execCommand(SKCmd::getSkInfo) > 0 ? InitializeState::waitProbeEinfo : InitializeState::uninitialized;
                 }
+                // 以前の応答が残っていても対応付けがずれないよう、送信済みのコマンドは破棄してから送る
+                this->commandEngine.clear();
+                this->pendingCommand = this->submitCommand(this->makeCommand(SKCmd::terminateSKStack));
+                return InitializeState::waitSKTermEchoBack;
             },
         },
-        {DECLARE_STATE(InitializeState::waitEverOk, true), .processor = EXPEXT_OK(InitializeState::setSKStackPassword, InitializeState::uninitialized)},
         {
-            DECLARE_STATE(InitializeState::setSKStackPassword, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::setSKStackPassword, &this->WPassword) > 0 ? InitializeState::waitSetSKStackPassword : InitializeState::uninitialized;
+            DECLARE_STATE_WITH_TIMEOUT(InitializeState::waitProbeEinfo, true, 3000, InitializeState::uninitialized),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (line.type == SkLine::Type::Einfo && line.tokenCount == 5) {
+                    if (line.tokens[2] != this->warmAttachSession.channel || line.tokens[3] != this->warmAttachSession.panId) {
+                        ESP_LOGI(TAG, "Module not joined to expected PAN (channel %s, Pan ID %s), cold start", line.tokens[2].str().c_str(), line.tokens[3].str().c_str());
+                        return InitializeState::uninitialized;
+                    }
+                    this->setSkInfo(line);
+                    this->CommunicationParameter = this->warmAttachSession;
+                    return InitializeState::waitProbeEinfoOk;
+                } else if (line.type == SkLine::Type::Fail) {
+                    return InitializeState::uninitialized;
+                } else {
+                    ESP_LOGD(TAG, "Unexpected line while probing session... continue");
+                    this->metrics.increment(Metrics::Counter::UnexpectedLines);
+                    return InitializeState::waitProbeEinfo;
+                }
             },
         },
-        {DECLARE_STATE(InitializeState::waitSetSKStackPassword, true), .processor = EXPEXT_OK(InitializeState::setSKStackId, InitializeState::uninitialized)},
         {
-            DECLARE_STATE(InitializeState::setSKStackId, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::setSKStackID, &this->WID) > 0 ? InitializeState::waitSetSKStackId : InitializeState::uninitialized;
+            DECLARE_STATE(InitializeState::waitProbeEinfoOk, true),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (line.type != SkLine::Type::Ok) {
+                    return InitializeState::uninitialized;
+                }
+                ESP_LOGI(TAG, "Module already joined to Pan ID %s, resume session", this->warmAttachSession.panId.c_str());
+                this->warmAttaching      = true;
+                this->warmAttachRequests = 0;
+                return InitializeState::readyCommunication;
             },
         },
-        {DECLARE_STATE(InitializeState::waitSetSKStackId, true), .processor = EXPEXT_OK(InitializeState::readOpt, InitializeState::uninitialized)},
         {
-            DECLARE_STATE(InitializeState::readOpt, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::readOpt) > 0 ? InitializeState::waitReadOpt : InitializeState::uninitialized;
+            DECLARE_TIMED_STATE(InitializeState::waitSKTermEchoBack),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (this->pendingCommand == nullptr || !this->pendingCommand->ready()) {
+                    return InitializeState::waitSKTermEchoBack;
+                }
+                // セッションがない場合は FAIL ER10 になるが、続けてリセットするので問題ない
+                if (this->pendingCommand->status == SkCommandResult::Status::Timeout) {
+                    ESP_LOGW(TAG, "No answer to SKTERM, reset anyway");
+                }
+                return InitializeState::resetSKStack;
             },
         },
         {
-            DECLARE_STATE(InitializeState::waitReadOpt, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::vector<std::string> tokens = splitString(line, ' ');
-                if (tokens.size() == 2 && tokens[0] == "OK" && tokens[1] == "01") {
-                    return InitializeState::activeScanWithIE;
-                } else {
-                    return InitializeState::writeOpt;
-                }
+            DECLARE_TIMED_STATE(InitializeState::resetSKStack),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                this->pendingCommand = this->submitCommand(this->makeCommand(SKCmd::resetSKStack));
+                return InitializeState::waitResetSKStackEchoBack;
             },
         },
         {
-            DECLARE_STATE(InitializeState::writeOpt, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::string arg = "01";
-                return this->execCommand(SKCmd::writeOpt, &arg) > 0 ? InitializeState::waitWriteOpt : InitializeState::uninitialized;
+            DECLARE_TIMED_STATE(InitializeState::waitResetSKStackEchoBack),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (this->pendingCommand == nullptr || !this->pendingCommand->ready()) {
+                    return InitializeState::waitResetSKStackEchoBack;
+                }
+                if (!this->pendingCommand->ok()) {
+                    ESP_LOGW(TAG, "SKRESET failed (ER%02u), reinitialize", this->pendingCommand->errorCode);
+                    return InitializeState::uninitialized;
+                }
+                return InitializeState::disableEcho;
             },
         },
-        {DECLARE_STATE(InitializeState::waitWriteOpt, true), .processor = EXPEXT_OK(InitializeState::activeScanWithIE, InitializeState::uninitialized)},
         {
             DECLARE_STATE(InitializeState::activeScanWithIE, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                // 絞り込んだスキャンでPANが見つからなければ、次からは設定したスキャン対象に戻す
+                const unsigned int mask = this->rescanChannelMask != 0 ? this->rescanChannelMask : this->scanChannelMask;
+                this->rescanChannelMask = 0;
                 char s[16];
-                snprintf(s, sizeof(s), "%d %08X %X", (uint8_t)this->scanMode, (unsigned)this->scanChannelMask, (unsigned)scanDuration);
+                snprintf(s, sizeof(s), "%d %08X %X", (uint8_t)this->scanMode, mask, (unsigned)scanDuration);
                 const std::string arg = std::string(s);
                 this->execCommand(SKCmd::scanSKStack, &arg);
+                this->metrics.increment(Metrics::Counter::Scans);
                 scanDuration = scanDuration < 14 ? scanDuration + 1 : scanDuration;
                 return InitializeState::waitActiveScanWithIEOk;
             },
         },
-        {DECLARE_STATE(InitializeState::waitActiveScanWithIEOk, true), .processor = EXPEXT_OK(InitializeState::waitScanEvent, InitializeState::waitActiveScanWithIEOk)},
+        {
+            DECLARE_STATE(InitializeState::waitActiveScanWithIEOk, true),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                return line.type == SkLine::Type::Ok ? InitializeState::waitScanEvent : this->onUnexpectedResponse(line, InitializeState::waitActiveScanWithIEOk, InitializeState::activeScanWithIE);
+            },
+        },
         {
             DECLARE_STATE(InitializeState::waitScanEvent, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
                 if (scanReceivedBeacon == true) {
                     scanReceivedEpanDesc = true;
                 }
-                const Event event = Event(line.c_str(), line.length());
-                ESP_LOGI(TAG, "Receive Event : %02X", event.type);
-                switch (event.type) {
+                ESP_LOGI(TAG, "Receive Event : %02X", (unsigned)line.eventType);
+                switch (line.eventType) {
                     case Event::Type::ReceiveBeacon:
                         ESP_LOGD(TAG, "Receive Beacon");
-                        this->CommunicationParameter.destIpv6Address = std::string(event.sender);
+                        this->CommunicationParameter.destIpv6Address = line.tokens[1].str();
                         ESP_LOGI(TAG, "Dest IPv6 : %s", this->CommunicationParameter.destIpv6Address.c_str());
                         scanReceivedBeacon = true;
                         return InitializeState::waitEpanDesc;
@@ -237,27 +519,28 @@ void BP35A1::buildStateMachine() {
                             return InitializeState::convertAddr;
                         } else {
                             ESP_LOGD(TAG, "Complete Active Scan, but not received beacon... retry");
+                            this->metrics.increment(Metrics::Counter::ScanRetries);
                             scanReceivedBeacon = scanReceivedEpanDesc = false;
                             return InitializeState::activeScanWithIE;
                         }
                     default:
                         ESP_LOGD(TAG, "Unexpected Event... continue");
+                        this->metrics.increment(Metrics::Counter::UnexpectedLines);
                         return InitializeState::waitScanEvent;
                 }
             },
         },
         {
             DECLARE_STATE(InitializeState::waitEpanDesc, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return line == "EPANDESC" ? InitializeState::waitEpanDescChannel : InitializeState::activeScanWithIE;
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                return line.type == SkLine::Type::Epandesc ? InitializeState::waitEpanDescChannel : InitializeState::activeScanWithIE;
             },
         },
         {
             DECLARE_STATE(InitializeState::waitEpanDescChannel, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::vector<std::string> tokens = splitString(line, ':');
-                if (tokens.size() == 2 && tokens[0].find("Channel") != std::string::npos) {
-                    this->CommunicationParameter.channel = trim(tokens[1]);
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (line.type == SkLine::Type::EpandescField && line.key == "Channel") {
+                    this->CommunicationParameter.channel = line.value.str();
                     ESP_LOGI(TAG, "Channel : %s", this->CommunicationParameter.channel.c_str());
                     return InitializeState::waitEpanDescChannelPage;
                 } else {
@@ -267,10 +550,9 @@ void BP35A1::buildStateMachine() {
         },
         {
             DECLARE_STATE(InitializeState::waitEpanDescChannelPage, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::vector<std::string> tokens = splitString(line, ':');
-                if (tokens.size() == 2 && tokens[0].find("Channel Page") != std::string::npos) {
-                    this->CommunicationParameter.channelPage = trim(tokens[1]);
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (line.type == SkLine::Type::EpandescField && line.key == "Channel Page") {
+                    this->CommunicationParameter.channelPage = line.value.str();
                     ESP_LOGI(TAG, "ChannelPage : %s", this->CommunicationParameter.channelPage.c_str());
                     return InitializeState::waitEpanDescPanId;
                 } else {
@@ -280,10 +562,9 @@ void BP35A1::buildStateMachine() {
         },
         {
             DECLARE_STATE(InitializeState::waitEpanDescPanId, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::vector<std::string> tokens = splitString(line, ':');
-                if (tokens.size() == 2 && tokens[0].find("Pan ID") != std::string::npos) {
-                    this->CommunicationParameter.panId = trim(tokens[1]);
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (line.type == SkLine::Type::EpandescField && line.key == "Pan ID") {
+                    this->CommunicationParameter.panId = line.value.str();
                     ESP_LOGI(TAG, "Pan ID : %s", this->CommunicationParameter.panId.c_str());
                     return InitializeState::waitEpanDescAddr;
                 } else {
@@ -293,10 +574,9 @@ void BP35A1::buildStateMachine() {
         },
         {
             DECLARE_STATE(InitializeState::waitEpanDescAddr, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::vector<std::string> tokens = splitString(line, ':');
-                if (tokens.size() == 2 && tokens[0].find("Addr") != std::string::npos) {
-                    this->CommunicationParameter.macAddress = trim(tokens[1]);
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (line.type == SkLine::Type::EpandescField && line.key == "Addr") {
+                    this->CommunicationParameter.macAddress = line.value.str();
                     ESP_LOGI(TAG, "Addr : %s", this->CommunicationParameter.macAddress.c_str());
                     return InitializeState::waitEpanDescLQI;
                 } else {
@@ -306,10 +586,10 @@ void BP35A1::buildStateMachine() {
         },
         {
             DECLARE_STATE(InitializeState::waitEpanDescLQI, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::vector<std::string> tokens = splitString(line, ':');
-                if (tokens.size() == 2 && tokens[0].find("LQI") != std::string::npos) {
-                    this->CommunicationParameter.LQI = trim(tokens[1]);
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (line.type == SkLine::Type::EpandescField && line.key == "LQI") {
+                    this->CommunicationParameter.LQI = line.value.str();
+                    this->linkQuality.addLqi(static_cast<uint8_t>(strtoul(this->CommunicationParameter.LQI.c_str(), nullptr, 16)));
                     ESP_LOGI(TAG, "LQI : %s", this->CommunicationParameter.LQI.c_str());
                     return InitializeState::waitEpanDescPairId;
                 } else {
@@ -319,10 +599,9 @@ void BP35A1::buildStateMachine() {
         },
         {
             DECLARE_STATE(InitializeState::waitEpanDescPairId, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::vector<std::string> tokens = splitString(line, ':');
-                if (tokens.size() == 2 && tokens[0].find("PairID") != std::string::npos) {
-                    this->CommunicationParameter.pairId = trim(tokens[1]);
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (line.type == SkLine::Type::EpandescField && line.key == "PairID") {
+                    this->CommunicationParameter.pairId = line.value.str();
                     ESP_LOGI(TAG, "PairID : %s", this->CommunicationParameter.pairId.c_str());
                     return InitializeState::waitScanEvent;
                 } else {
@@ -330,67 +609,32 @@ void BP35A1::buildStateMachine() {
                 }
             },
         },
-        {
-            DECLARE_STATE(InitializeState::convertAddr, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::convertMac2IPv6, &this->CommunicationParameter.macAddress) > 0 ? InitializeState::waitConvertAddr : InitializeState::activeScanWithIE;
-            },
-        },
-        {
-            DECLARE_STATE(InitializeState::waitConvertAddr, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                if (line.length() == 39) {
-                    this->CommunicationParameter.ipv6Address = trim(line);
-                    ESP_LOGI(TAG, "IPv6 : %s", this->CommunicationParameter.ipv6Address.c_str());
-                    return InitializeState::setChannel;
-                } else {
-                    return InitializeState::activeScanWithIE;
-                }
-            },
-        },
-        {
-            DECLARE_STATE(InitializeState::setChannel, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->settingRegister(RegisterNum::ChannelNumber, this->CommunicationParameter.channel) > 0 ? InitializeState::waitSetChannel : InitializeState::activeScanWithIE;
-            },
-        },
-        {DECLARE_STATE(InitializeState::waitSetChannel, true), .processor = EXPEXT_OK(InitializeState::setPanId, InitializeState::activeScanWithIE)},
-        {
-            DECLARE_STATE(InitializeState::setPanId, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->settingRegister(RegisterNum::PanId, this->CommunicationParameter.panId) > 0 ? InitializeState::waitSetPanId : InitializeState::activeScanWithIE;
-            },
-        },
-        {DECLARE_STATE(InitializeState::waitSetPanId, true), .processor = EXPEXT_OK(InitializeState::skJoin, InitializeState::activeScanWithIE)},
-        {
-            DECLARE_STATE(InitializeState::skJoin, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::joinSKStack, &this->CommunicationParameter.ipv6Address) > 0 ? InitializeState::waitSkJoin : InitializeState::activeScanWithIE;
-            },
-        },
-        {DECLARE_STATE(InitializeState::waitSkJoin, true), .processor = EXPEXT_OK(InitializeState::waitPana, InitializeState::activeScanWithIE)},
         {
             DECLARE_STATE(InitializeState::waitPana, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const Event event = Event(line.c_str(), line.length());
-                ESP_LOGI(TAG, "Receive Event : %02X", event.type);
-                switch (event.type) {
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                ESP_LOGI(TAG, "Receive Event : %02X", (unsigned)line.eventType);
+                switch (line.eventType) {
                     case Event::Type::SuccessPANA:
                         ESP_LOGD(TAG, "Success PANA");
                         return InitializeState::readyCommunication;
                     case Event::Type::FailedPANA:
-                        pana_fail_count_++;
-                        ESP_LOGW(TAG, "PANA authentication failed (%u times) - check B-route ID and password", pana_fail_count_);
-                        return InitializeState::convertAddr;
+                        metrics.increment(Metrics::Counter::PanaFailures);
+                        ESP_LOGW(TAG, "PANA authentication failed (%u times) - check B-route ID and password", (unsigned)this->getPanaFailCount());
+                        return this->recover(InitializeState::skJoin);
                     default:
                         ESP_LOGD(TAG, "Unexpected Event... continue");
+                        this->metrics.increment(Metrics::Counter::UnexpectedLines);
                         return InitializeState::waitPana;
                 }
             },
         },
         {
             DECLARE_STATE(InitializeState::readyCommunication, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (this->warmAttaching && this->warmAttachRequests++ >= 2) {
+                    ESP_LOGW(TAG, "Smart meter does not answer on resumed session, cold start");
+                    return InitializeState::uninitialized;
+                }
                 this->echonet.generateGetRequest(std::vector<LowVoltageSmartElectricEnergyMeterClass::Property>({
                     LowVoltageSmartElectricEnergyMeterClass::Property::Coefficient,
                     LowVoltageSmartElectricEnergyMeterClass::Property::CumulativeEnergyUnit,
@@ -400,54 +644,328 @@ void BP35A1::buildStateMachine() {
             },
         },
         {
-            DECLARE_STATE(InitializeState::waitInitParamSuccessUdpSend, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return checkSuccessUdpSend(line, InitializeState::waitInitParamErxudp, InitializeState::waitInitParamSuccessUdpSend);
+            DECLARE_STATE_WITH_TIMEOUT(InitializeState::waitInitParamSuccessUdpSend, true, 10000, InitializeState::readyCommunication),
+            .onTimeout = [this]() { return this->onInitParamFailure(); },
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                const InitializeState next = checkSuccessUdpSend(line, InitializeState::waitInitParamErxudp, InitializeState::waitInitParamSuccessUdpSend, InitializeState::waitInitParamRetryUdpSend, InitializeState::uninitialized);
+                if (next == InitializeState::uninitialized && !this->warmAttaching) {
+                    return this->recover(InitializeState::readyCommunication);
+                }
+                return next;
             },
         },
         {
-            DECLARE_STATE(InitializeState::waitInitParamErxudp, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                if (line.find("ERXUDP " + this->CommunicationParameter.ipv6Address) != std::string::npos) {
-                    const std::string payload = ErxUdp(line).payload;
-                    if (!payload.empty() && this->echonet.load(payload.c_str()) && this->echonet.initializeParameter()) {
+            DECLARE_TIMED_STATE(InitializeState::waitInitParamRetryUdpSend),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                return retryUdpSend(InitializeState::waitInitParamRetryUdpSend, InitializeState::waitInitParamSuccessUdpSend);
+            },
+        },
+        {
+            DECLARE_STATE_WITH_TIMEOUT(InitializeState::waitInitParamErxudp, true, 10000, InitializeState::readyCommunication),
+            .onTimeout = [this]() { return this->onInitParamFailure(); },
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (this->isErxUdpFromMeter(line)) {
+                    const bool decoded = this->erxUdp.parse(line.text()) && this->erxUdp.decodePayload(this->erxUdpData);
+                    if (decoded && !isResponseTo(this->erxUdpData, this->udpSendRequest.data)) {
+                        ESP_LOGD(TAG, "ERXUDP is not the response to the pending request... continue");
+                        this->metrics.increment(Metrics::Counter::UnexpectedLines);
+                        return InitializeState::waitInitParamErxudp;
+                    }
+                    if (decoded && loadFrame(&this->echonet, this->erxUdp, this->erxUdpData) && this->echonet.initializeParameter()) {
                         ESP_LOGI(TAG, "ConvertCumulativeEnergyUnit : %f", this->echonet.getCumulativeEnergyUnit());
                         ESP_LOGI(TAG, "SyntheticTransformationRatio: %d", this->echonet.getSyntheticTransformationRatio());
-                        return InitializeState::requerySKInfo;
+                        this->propertyScale.coefficient = this->echonet.getSyntheticTransformationRatio();
+                        this->propertyScale.unit        = this->echonet.getCumulativeEnergyUnit();
+                        if (this->verifyDerivedValues) {
+                            return InitializeState::requerySKInfo;
+                        }
+                        // JOIN後のSKINFOは初期化時のEINFOと設定したチャンネル・PAN IDから分かる
+                        this->skinfo.channel = this->CommunicationParameter.channel;
+                        this->skinfo.panId   = this->CommunicationParameter.panId;
+                        this->warmAttaching  = false;
+                        return InitializeState::readySmartMeter;
                     } else {
-                        return InitializeState::readyCommunication;
+                        ESP_LOGW(TAG, "Invalid response to the initial parameter request");
+                        return this->onInitParamFailure();
                     }
                 } else {
                     ESP_LOGD(TAG, "Unexpected Event... continue");
+                    this->metrics.increment(Metrics::Counter::UnexpectedLines);
                     return InitializeState::waitInitParamErxudp;
                 }
             },
         },
         {
             DECLARE_STATE(InitializeState::requerySKInfo, false),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                return this->execCommand(SKCmd::getSkInfo) > 0 ? InitializeState::waitRequeryEinfo : InitializeState::requerySKInfo;
-            },
-        },
-        {
-            DECLARE_STATE(InitializeState::waitRequeryEinfo, true),
-            .processor = [this](const std::string &line, const StateMachineCallback_t callback) {
-                const std::vector<std::string> tokens = splitString(line, ' ');
-                if (tokens.size() == 6 && tokens[0] == "EINFO") {
-                    this->skinfo.ipv6Address  = tokens[1];
-                    this->skinfo.macAddress64 = tokens[2];
-                    this->skinfo.channel      = tokens[3];
-                    this->skinfo.panId        = tokens[4];
-                    this->skinfo.macAddress16 = tokens[5];
-                    ESP_LOGI(TAG, "Re-queried SKINFO - ipv6: %s, mac16: %s", this->skinfo.ipv6Address.c_str(), this->skinfo.macAddress16.c_str());
-                    return InitializeState::readySmartMeter;
-                } else {
-                    ESP_LOGD(TAG, "Unexpected EINFO response, continue");
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                this->pendingCommand = this->submitCommand(this->makeCommand(SKCmd::getSkInfo));
+                return InitializeState::waitRequeryEinfo;
+            },
+        },
+        {
+            DECLARE_TIMED_STATE(InitializeState::waitRequeryEinfo),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                if (this->pendingCommand == nullptr || !this->pendingCommand->ready()) {
                     return InitializeState::waitRequeryEinfo;
                 }
+                for (const std::string &response : this->pendingCommand->lines) {
+                    const SkLine einfo(response);
+                    if (einfo.type == SkLine::Type::Einfo && einfo.tokenCount == 5) {
+                        if (einfo.tokens[0] != this->skinfo.ipv6Address || einfo.tokens[2] != this->CommunicationParameter.channel || einfo.tokens[3] != this->CommunicationParameter.panId) {
+                            ESP_LOGW(TAG, "SKINFO differs from expected (ipv6 %s, channel %s, Pan ID %s)", this->skinfo.ipv6Address.c_str(), this->CommunicationParameter.channel.c_str(), this->CommunicationParameter.panId.c_str());
+                            this->metrics.increment(Metrics::Counter::DerivedValueMismatches);
+                        }
+                        this->setSkInfo(einfo);
+                        ESP_LOGI(TAG, "Re-queried SKINFO - ipv6: %s, mac16: %s", this->skinfo.ipv6Address.c_str(), this->skinfo.macAddress16.c_str());
+                        this->warmAttaching = false;
+                        return InitializeState::readySmartMeter;
+                    }
+                }
+                ESP_LOGD(TAG, "Unexpected EINFO response, retry");
+                this->metrics.increment(Metrics::Counter::UnexpectedLines);
+                return InitializeState::requerySKInfo;
+            },
+        },
+        {
+            // 送り直しても同じ結果になるため、initializeLoop(true) で再初期化されるまで何もしない
+            DECLARE_TIMED_STATE(InitializeState::commandRejected),
+            .processor = [this](const SkLine &line, const StateMachineCallback_t callback) {
+                return InitializeState::commandRejected;
+            },
+        },
+    };
+
+    const std::vector<CommandStep> commandSteps = {
+        {
+            InitializeState::disableEcho,
+            InitializeState::waitDisableEcho,
+            [this]() { return this->makeCommand(SKCmd::disableEcho); },
+            InitializeState::getSKInfo,
+        },
+        {
+            InitializeState::getSKInfo,
+            InitializeState::waitEinfo,
+            [this]() { return this->makeCommand(SKCmd::getSkInfo); },
+            InitializeState::getSKStackVersion,
+            [this](const SkCommandResult &result) {
+                if (!result.ok()) {
+                    return this->onCommandFailure(result.errorCode, InitializeState::getSKInfo);
+                }
+                const SkLine einfo = result.lines.empty() ? SkLine() : SkLine(result.lines[0]);
+                if (einfo.type != SkLine::Type::Einfo || einfo.tokenCount != 5) {
+                    ESP_LOGE(TAG, "Unexpected SKINFO response");
+                    return this->onCommandFailure(0, InitializeState::getSKInfo);
+                }
+                this->setSkInfo(einfo);
+                ESP_LOGI(TAG, "ipv6Address  : %s", this->skinfo.ipv6Address.c_str());
+                ESP_LOGI(TAG, "macAddress64 : %s", this->skinfo.macAddress64.c_str());
+                ESP_LOGI(TAG, "channel      : %s", this->skinfo.channel.c_str());
+                ESP_LOGI(TAG, "panId        : %s", this->skinfo.panId.c_str());
+                ESP_LOGI(TAG, "macAddress16 : %s", this->skinfo.macAddress16.c_str());
+                return InitializeState::getSKStackVersion;
+            },
+        },
+        {
+            InitializeState::getSKStackVersion,
+            InitializeState::waitEver,
+            [this]() { return this->makeCommand(SKCmd::getSKStackVersion); },
+            InitializeState::setUartBaudRate,
+            [this](const SkCommandResult &result) {
+                if (!result.ok()) {
+                    return this->onCommandFailure(result.errorCode, InitializeState::getSKStackVersion);
+                }
+                const SkLine ever = result.lines.empty() ? SkLine() : SkLine(result.lines[0]);
+                if (ever.type != SkLine::Type::Ever || ever.tokenCount != 1) {
+                    ESP_LOGE(TAG, "Unexpected SKVER response");
+                    return this->onCommandFailure(0, InitializeState::getSKStackVersion);
+                }
+                this->eVer = ever.tokens[0].str();
+                ESP_LOGI(TAG, "EVER : %s", this->eVer.c_str());
+                return InitializeState::setUartBaudRate;
+            },
+        },
+        {
+            InitializeState::setUartBaudRate,
+            InitializeState::waitSetUartBaudRate,
+            [this]() {
+                this->previousUartBaudRate = this->serial_.getBaudRate();
+                if (this->uartBaudRate == 0 || this->uartBaudRate == this->previousUartBaudRate) {
+                    return std::string();
+                }
+                if (this->previousUartBaudRate == 0 || uartMode(this->uartBaudRate) < 0 || uartMode(this->previousUartBaudRate) < 0) {
+                    ESP_LOGW(TAG, "UART baud rate %u -> %u not supported", (unsigned)this->previousUartBaudRate, (unsigned)this->uartBaudRate);
+                    this->uartBaudRate = 0;
+                    return std::string();
+                }
+                char s[4];
+                snprintf(s, sizeof(s), "%02X", uartMode(this->uartBaudRate));
+                const std::string arg = std::string(s);
+                return this->makeCommand(SKCmd::writeUart, &arg);
+            },
+            InitializeState::setSKStackPassword,
+            [this](const SkCommandResult &result) {
+                if (!result.ok()) {
+                    ESP_LOGW(TAG, "WUART failed (ER%02u), keep %u bps", result.errorCode, (unsigned)this->previousUartBaudRate);
+                    this->uartBaudRate = 0;
+                    return InitializeState::setSKStackPassword;
+                }
+                if (!this->serial_.setBaudRate(this->uartBaudRate)) {
+                    ESP_LOGW(TAG, "Host UART does not support changing baud rate");
+                    return InitializeState::revertUartBaudRate;
+                }
+                this->uartVerifyAttempts = 0;
+                return InitializeState::verifyUartBaudRate;
+            },
+        },
+        {
+            InitializeState::verifyUartBaudRate,
+            InitializeState::waitVerifyUartBaudRate,
+            [this]() {
+                this->uartVerifyAttempts++;
+                return this->makeCommand(SKCmd::getSKStackVersion);
+            },
+            InitializeState::setSKStackPassword,
+            [this](const SkCommandResult &result) {
+                const SkLine ever = result.lines.empty() ? SkLine() : SkLine(result.lines[0]);
+                if (result.ok() && ever.type == SkLine::Type::Ever && ever.tokens[0] == this->eVer) {
+                    ESP_LOGI(TAG, "UART baud rate changed to %u bps", (unsigned)this->uartBaudRate);
+                    return InitializeState::setSKStackPassword;
+                }
+                if (this->uartVerifyAttempts < maxUartVerifyAttempts) {
+                    return InitializeState::verifyUartBaudRate;
+                }
+                ESP_LOGW(TAG, "No answer at %u bps, fall back to %u bps", (unsigned)this->uartBaudRate, (unsigned)this->previousUartBaudRate);
+                this->serial_.setBaudRate(this->previousUartBaudRate);
+                return InitializeState::revertUartBaudRate;
+            },
+        },
+        {
+            // WUARTは不揮発に保存されるため、次回起動時に速度が食い違わないよう元に戻す
+            InitializeState::revertUartBaudRate,
+            InitializeState::waitRevertUartBaudRate,
+            [this]() {
+                char s[4];
+                snprintf(s, sizeof(s), "%02X", uartMode(this->previousUartBaudRate));
+                const std::string arg = std::string(s);
+                this->uartBaudRate    = 0;
+                return this->makeCommand(SKCmd::writeUart, &arg);
+            },
+            InitializeState::setSKStackPassword,
+            [this](const SkCommandResult &result) {
+                if (!result.ok()) {
+                    ESP_LOGE(TAG, "Failed to restore UART baud rate %u bps", (unsigned)this->previousUartBaudRate);
+                }
+                return InitializeState::setSKStackPassword;
+            },
+        },
+        {
+            InitializeState::setSKStackPassword,
+            InitializeState::waitSetSKStackPassword,
+            [this]() { return this->makeCommand(SKCmd::setSKStackPassword, &this->WPassword); },
+            InitializeState::setSKStackId,
+        },
+        {
+            InitializeState::setSKStackId,
+            InitializeState::waitSetSKStackId,
+            [this]() { return this->makeCommand(SKCmd::setSKStackID, &this->WID); },
+            InitializeState::readOpt,
+        },
+        {
+            // ERXUDPのデータ部がすでに16進ASCII(OK 01)ならWOPTを省く
+            InitializeState::readOpt,
+            InitializeState::waitReadOpt,
+            [this]() { return this->makeCommand(SKCmd::readOpt); },
+            InitializeState::writeOpt,
+            [this](const SkCommandResult &result) {
+                if (!result.ok()) {
+                    return this->onCommandFailure(result.errorCode, InitializeState::readOpt);
+                }
+                return !result.lines.empty() && result.lines[0] == "01" ? InitializeState::activeScanWithIE : InitializeState::writeOpt;
+            },
+        },
+        {
+            InitializeState::writeOpt,
+            InitializeState::waitWriteOpt,
+            [this]() { const std::string arg = "01"; return this->makeCommand(SKCmd::writeOpt, &arg); },
+            InitializeState::activeScanWithIE,
+        },
+        {
+            InitializeState::convertAddr,
+            InitializeState::waitConvertAddr,
+            [this]() {
+                if (!linkLocalAddress(this->CommunicationParameter.macAddress, &this->CommunicationParameter.ipv6Address)) {
+                    this->CommunicationParameter.ipv6Address.clear();
+                } else if (!this->verifyDerivedValues) {
+                    ESP_LOGI(TAG, "IPv6 : %s", this->CommunicationParameter.ipv6Address.c_str());
+                    return std::string();
+                }
+                // MACアドレスが想定外の形式の場合と、確認を求められた場合だけSKLL64で変換する
+                return this->makeCommand(SKCmd::convertMac2IPv6, &this->CommunicationParameter.macAddress);
             },
+            InitializeState::setChannel,
+            [this](const SkCommandResult &result) {
+                if (!result.ok()) {
+                    return this->onCommandFailure(result.errorCode, InitializeState::convertAddr);
+                }
+                const std::string &ipv6Address = result.lines[0];
+                if (!this->CommunicationParameter.ipv6Address.empty() && ipv6Address != this->CommunicationParameter.ipv6Address) {
+                    ESP_LOGW(TAG, "SKLL64 returned %s, expected %s", ipv6Address.c_str(), this->CommunicationParameter.ipv6Address.c_str());
+                    this->metrics.increment(Metrics::Counter::DerivedValueMismatches);
+                }
+                this->CommunicationParameter.ipv6Address = ipv6Address;
+                ESP_LOGI(TAG, "IPv6 : %s", this->CommunicationParameter.ipv6Address.c_str());
+                return InitializeState::setChannel;
+            },
+            SkCommandResult::Terminator::SingleLine,
+        },
+        {
+            InitializeState::setChannel,
+            InitializeState::waitSetChannel,
+            [this]() { return this->makeRegisterCommand(RegisterNum::ChannelNumber, &this->CommunicationParameter.channel); },
+            InitializeState::setPanId,
+        },
+        {
+            InitializeState::setPanId,
+            InitializeState::waitSetPanId,
+            [this]() { return this->makeRegisterCommand(RegisterNum::PanId, &this->CommunicationParameter.panId); },
+            InitializeState::skJoin,
+        },
+        {
+            InitializeState::skJoin,
+            InitializeState::waitSkJoin,
+            [this]() { return this->makeCommand(SKCmd::joinSKStack, &this->CommunicationParameter.ipv6Address); },
+            InitializeState::waitPana,
         },
     };
+    for (const CommandStep &step : commandSteps) {
+        init_state_machines_.push_back({
+            DECLARE_TIMED_STATE(step.send),
+            .processor = [this, step](const SkLine &line, const StateMachineCallback_t callback) {
+                const std::string command = step.command();
+                if (command.empty()) {
+                    return step.success;
+                }
+                this->pendingCommand = this->submitCommand(command, nullptr, step.terminator);
+                return step.wait;
+            },
+        });
+        init_state_machines_.push_back({
+            DECLARE_TIMED_STATE(step.wait),
+            .processor = [this, step](const SkLine &line, const StateMachineCallback_t callback) {
+                if (this->pendingCommand == nullptr || !this->pendingCommand->ready()) {
+                    return step.wait;
+                }
+                if (step.complete != nullptr) {
+                    return step.complete(*this->pendingCommand);
+                }
+                if (!this->pendingCommand->ok()) {
+                    ESP_LOGW(TAG, "Command failed (status %u, ER%02u)", (unsigned)this->pendingCommand->status, this->pendingCommand->errorCode);
+                    return this->onCommandFailure(this->pendingCommand->errorCode, step.send);
+                }
+                return step.success;
+            },
+        });
+    }
 }
 
 const BP35A1::StateMachine<BP35A1::InitializeState> *BP35A1::getStateMachine(const InitializeState state) {
@@ -458,15 +976,197 @@ const BP35A1::StateMachine<BP35A1::CommunicationState> *BP35A1::getStateMachine(
     return findStateMachine(&comm_state_machines_, state);
 }
 
-size_t BP35A1::settingRegister(const RegisterNum registerNum, const std::string &arg) {
+std::string BP35A1::makeRegisterCommand(const RegisterNum registerNum, const std::string *const arg) const {
     char c[32];
-    snprintf(c, sizeof(c), "S%X %s", (uint8_t)registerNum, arg.c_str());
+    if (arg == nullptr) {
+        snprintf(c, sizeof(c), "S%X", (uint8_t)registerNum);
+    } else {
+        snprintf(c, sizeof(c), "S%X %s", (uint8_t)registerNum, arg->c_str());
+    }
     const std::string s = std::string(c);
-    return this->execCommand(SKCmd::setRegister, &s);
+    return this->makeCommand(SKCmd::setRegister, &s);
+}
+
+SkCommandFuture BP35A1::submitCommand(const std::string &command, SkCommandEngine::Callback done, SkCommandResult::Terminator terminator) {
+    ESP_LOGD(TAG, ">> %s", command.c_str());
+    return this->commandEngine.submit(command, nowMillis(), std::move(done), terminator);
+}
+
+SkCommandFuture BP35A1::readRegister(const RegisterNum registerNum, SkCommandEngine::Callback done) {
+    return this->submitCommand(this->makeRegisterCommand(registerNum), std::move(done));
+}
+
+SkCommandFuture BP35A1::writeRegister(const RegisterNum registerNum, const std::string &value, SkCommandEngine::Callback done) {
+    return this->submitCommand(this->makeRegisterCommand(registerNum, &value), std::move(done));
+}
+
+void BP35A1::serviceCommandEngine() {
+    this->commandEngine.poll(nowMillis());
+    if (this->commandEngine.busy() && this->serial_.available()) {
+        if (!this->receiveLine()) {
+            return;
+        }
+        const SkLine line(this->rxLine);
+        observeLine(line);
+        if (!this->commandEngine.onLine(line, nowMillis())) {
+            ESP_LOGD(TAG, "Unexpected line while idle... ignore");
+            this->metrics.increment(Metrics::Counter::UnexpectedLines);
+        }
+    }
+}
+
+bool BP35A1::receiveLine() {
+    if (this->serial_.readLine(this->rxLine, '\n')) {
+        this->receivedBytes += this->rxLine.length() + 1;
+    }
+    trimInPlace(this->rxLine);
+    if (this->rxLine.empty()) {
+        return false;
+    }
+    ESP_LOGD(TAG, "<< %s", this->rxLine.c_str());
+    return true;
+}
+
+bool BP35A1::isErxUdpFromMeter(const SkLine &line) const {
+    return line.type == SkLine::Type::ErxUdp && line.tokenCount > 0 && line.tokens[0] == this->CommunicationParameter.ipv6Address;
+}
+
+void BP35A1::setSkInfo(const SkLine &einfo) {
+    this->skinfo.ipv6Address  = einfo.tokens[0].str();
+    this->skinfo.macAddress64 = einfo.tokens[1].str();
+    this->skinfo.channel      = einfo.tokens[2].str();
+    this->skinfo.panId        = einfo.tokens[3].str();
+    this->skinfo.macAddress16 = einfo.tokens[4].str();
+}
+
+void BP35A1::observeLine(const SkLine &line) {
+    if (line.type != SkLine::Type::Event) {
+        return;
+    }
+    switch (line.eventType) {
+        case Event::Type::ErrorARIB108SendingTime:
+            ESP_LOGW(TAG, "ARIB STD-T108 sending time limit reached");
+            this->airtimeBudget.onLimitReached(nowMillis());
+            break;
+        case Event::Type::ReleaseARIB108SendingTime:
+            ESP_LOGI(TAG, "ARIB STD-T108 sending time limit released");
+            this->airtimeBudget.onLimitReleased();
+            break;
+        default:
+            break;
+    }
+}
+
+void BP35A1::dispatchProperties() {
+    // EHD1 EHD2 TID(2) SEOJ(3) DEOJ(3) ESV OPC (EPC PDC EDT)...
+    constexpr size_t opcOffset = 11;
+    if (this->erxUdpData.size() <= opcOffset) {
+        return;
+    }
+    const uint8_t opc = this->erxUdpData[opcOffset];
+    size_t pos        = opcOffset + 1;
+    for (uint8_t i = 0; i < opc && pos + 1 < this->erxUdpData.size(); i++) {
+        const uint8_t epc = this->erxUdpData[pos];
+        const uint8_t pdc = this->erxUdpData[pos + 1];
+        if (pos + 2 + pdc > this->erxUdpData.size()) {
+            break;
+        }
+        const int8_t index = PropertyDecoder::indexTable[epc];
+        if (pdc > 0 && index >= 0 && this->propertyHandlers[index] != nullptr) {
+            this->propertyHandlers[index](&this->erxUdpData[pos + 2], pdc, this->propertyScale);
+        }
+        pos += 2 + pdc;
+    }
+}
+
+void BP35A1::reselectChannel() {
+    const uint8_t channel = static_cast<uint8_t>(strtoul(this->CommunicationParameter.channel.c_str(), nullptr, 16));
+    const uint32_t mask   = this->linkQuality.quietChannelMask(channel, this->edQuietThreshold) & this->scanChannelMask;
+    ESP_LOGW(TAG, "Link degraded (LQI avg %.1f, send success %.2f), rescan channel mask %08X", this->linkQuality.getLqi().value, this->linkQuality.getSendSuccessRatio().value, (unsigned)mask);
+    this->rescanChannelMask = mask;
+    this->linkQuality.resetLinkStatistics();
+    this->setInitializeState(InitializeState::activeScanWithIE);
+}
+
+BP35A1::InitializeState BP35A1::recover(const InitializeState retryState, const RecoveryPolicy::Tier minimumTier) {
+    // スキャン前のコマンドは再送かリセットのみ、スキャン中は再JOINできない
+    uint8_t applicable = RecoveryPolicy::bit(RecoveryPolicy::Tier::Retry) | RecoveryPolicy::bit(RecoveryPolicy::Tier::Reset);
+    if (retryState >= InitializeState::activeScanWithIE) {
+        applicable |= RecoveryPolicy::bit(RecoveryPolicy::Tier::Rescan);
+    }
+    if (retryState >= InitializeState::convertAddr) {
+        applicable |= RecoveryPolicy::bit(RecoveryPolicy::Tier::Rejoin);
+    }
+    const RecoveryPolicy::Tier tier = this->recoveryPolicy.onFailure(nowMillis(), minimumTier, applicable);
+    InitializeState next            = InitializeState::uninitialized;
+    switch (tier) {
+        case RecoveryPolicy::Tier::Retry:
+            next = retryState;
+            this->metrics.increment(Metrics::Counter::RecoveryRetries);
+            break;
+        case RecoveryPolicy::Tier::Rejoin:
+            next = retryState <= InitializeState::waitConvertAddr ? InitializeState::convertAddr : InitializeState::setChannel;
+            this->metrics.increment(Metrics::Counter::RecoveryRejoins);
+            break;
+        case RecoveryPolicy::Tier::Rescan:
+            next = InitializeState::activeScanWithIE;
+            this->metrics.increment(Metrics::Counter::RecoveryRescans);
+            break;
+        default:
+            this->metrics.increment(Metrics::Counter::RecoveryResets);
+            break;
+    }
+    ESP_LOGW(TAG, "Recovery tier %u: state %u -> %u", (unsigned)tier, (unsigned)retryState, (unsigned)next);
+    return next;
+}
+
+BP35A1::InitializeState BP35A1::onCommandFailure(const uint8_t errorCode, const InitializeState resend) {
+    if (SkCommandResult::isBusyError(errorCode)) {
+        if (this->busyRetryState != resend) {
+            this->busyRetryState = resend;
+            this->busyRetries    = 0;
+        }
+        if (this->busyRetries < maxBusyRetries) {
+            this->busyRetries++;
+            this->metrics.increment(Metrics::Counter::CommandBusyRetries);
+            ESP_LOGD(TAG, "Command busy (ER%02u), resend immediately (%u)", errorCode, this->busyRetries);
+            return resend;
+        }
+    }
+    if (SkCommandResult::isRejectError(errorCode)) {
+        this->metrics.increment(Metrics::Counter::CommandRejections);
+        ESP_LOGE(TAG, "Command rejected (ER%02u) in state %u, check the settings and reinitialize", errorCode, (unsigned)resend);
+        return InitializeState::commandRejected;
+    }
+    return this->recover(resend);
+}
+
+BP35A1::InitializeState BP35A1::onUnexpectedResponse(const SkLine &line, const InitializeState waiting, const InitializeState resend) {
+    if (line.isAsync() || line.type == SkLine::Type::Echo) {
+        ESP_LOGD(TAG, "Ignore line while waiting for response : %s", line.text().c_str());
+        this->metrics.increment(Metrics::Counter::UnexpectedLines);
+        return waiting;
+    }
+    if (line.type == SkLine::Type::Fail) {
+        return this->onCommandFailure(line.errorCode, resend);
+    }
+    ESP_LOGE(TAG, "Unexpected line : %s", line.text().c_str());
+    return this->onCommandFailure(0, resend);
+}
+
+BP35A1::InitializeState BP35A1::onInitParamFailure() {
+    return this->warmAttaching ? InitializeState::readyCommunication : this->recover(InitializeState::readyCommunication);
+}
+
+void BP35A1::setInitializeState(const InitializeState state) {
+    this->initializeState = state;
+    if (this->callback != nullptr) {
+        this->callback(this->initializeState);
+    }
 }
 
 BP35A1::BP35A1(std::string ID, std::string Password, ISerialIO &serial)
-    : serial_(serial), WPassword(std::move(Password)), WID(std::move(ID)) {
+    : serial_(serial), commandEngine(serial), WPassword(std::move(Password)), WID(std::move(ID)) {
     buildStateMachine();
 }
 
@@ -474,6 +1174,24 @@ void BP35A1::setStatusChangeCallback(std::function<void(InitializeState)> cb) {
     this->callback = std::move(cb);
 }
 
+void BP35A1::setWarmAttachSession(const std::string &channel, const std::string &panId, const std::string &ipv6Address) {
+    PanDescriptor session;
+    session.channel         = channel;
+    session.panId           = panId;
+    session.ipv6Address     = ipv6Address;
+    session.destIpv6Address = ipv6Address;
+    this->setWarmAttachSession(session);
+}
+
+void BP35A1::setWarmAttachSession(const PanDescriptor &session) {
+    this->warmAttachSession = session;
+    this->warmAttachPending = !session.channel.empty() && !session.panId.empty() && !session.ipv6Address.empty();
+}
+
+void BP35A1::setUdpSendFailedCallback(std::function<void(uint8_t)> cb) {
+    this->udpSendFailedCallback = std::move(cb);
+}
+
 BP35A1::InitializeState BP35A1::getInitializeState() const {
     return this->initializeState;
 }
@@ -486,38 +1204,79 @@ void BP35A1::resetInitializeState() {
     this->initializeState   = InitializeState::uninitialized;
     udpSendReceivedOk       = false;
     udpSendReceivedComplete = false;
-    disableEchoReceivedOk   = false;
-    disableEchoReceivedEcho = false;
     scanDuration            = 3;
+    rescanChannelMask       = 0;
     scanReceivedBeacon      = false;
     scanReceivedEpanDesc    = false;
+    udpSendRequest.attempts = 0;
+    commandEngine.clear();
+    pendingCommand = nullptr;
+}
+
+const Metrics &BP35A1::getMetrics() {
+    const uint32_t now = nowMillis();
+    this->metrics.set(Metrics::Gauge::Lqi, static_cast<int32_t>(this->linkQuality.getLqi().value + 0.5f));
+    this->metrics.set(Metrics::Gauge::InitializeState, static_cast<int32_t>(this->initializeState));
+    this->metrics.set(Metrics::Gauge::CommunicationState, static_cast<int32_t>(this->communicationState));
+    this->metrics.set(Metrics::Gauge::TimeInInitializeStateMs, this->initializeStateEntry.state == static_cast<int>(this->initializeState) ? static_cast<int32_t>(now - this->initializeStateEntry.since) : 0);
+    this->metrics.set(Metrics::Gauge::TimeInCommunicationStateMs, this->communicationStateEntry.state == static_cast<int>(this->communicationState) ? static_cast<int32_t>(now - this->communicationStateEntry.since) : 0);
+    this->metrics.set(Metrics::Gauge::AirtimeRemainingMs, static_cast<int32_t>(this->airtimeBudget.remaining(now)));
+    this->metrics.set(Metrics::Gauge::WakeLatencyMs, static_cast<int32_t>(this->wakeLatency.value + 0.5f));
+    return this->metrics;
 }
 
 void BP35A1::resetCommunicationState() {
     this->communicationState = CommunicationState::ready;
 }
 
+std::string BP35A1::makeCommand(const SKCmd skCmdNum, const std::string *const arg) const {
+    return arg == nullptr ? this->skCmd[skCmdNum] : this->skCmd[skCmdNum] + " " + *arg;
+}
+
 size_t BP35A1::execCommand(const SKCmd skCmdNum, const std::string *const arg) {
-    const std::string command = arg == nullptr ? this->skCmd[skCmdNum] : this->skCmd[skCmdNum] + " " + *arg;
+    const std::string command = this->makeCommand(skCmdNum, arg);
     ESP_LOGD(TAG, ">> %s", command.c_str());
-    const size_t ret = this->serial_.println(command);
-    this->serial_.flush();
-    return ret;
+    return this->serial_.println(command);
 }
 
 template <class StateType>
-bool BP35A1::stateMachineLoop(const StateMachine<StateType> *const stateMachine, StateType *const recordedState, const StateType expectedState, const StateMachineCallback_t callback) {
+bool BP35A1::stateMachineLoop(const StateMachine<StateType> *const stateMachine, StateType *const recordedState, StateEntry *const stateEntry, const StateType expectedState, const StateMachineCallback_t callback) {
     if (stateMachine != nullptr && recordedState != nullptr && stateMachine->state == *recordedState) {
-        if (stateMachine->read == false || (stateMachine->read == true && this->serial_.available())) {
-            std::string rxBuffer = this->serial_.readStringUntil('\n');
-            rxBuffer             = trim(rxBuffer);
-            if (stateMachine->read == true && rxBuffer.length() == 0) {
-                return *recordedState == expectedState;
+        if (stateEntry->state != static_cast<int>(*recordedState)) {
+            stateEntry->state = static_cast<int>(*recordedState);
+            stateEntry->since = nowMillis();
+        }
+        if (stateMachine->timeout > 0 && nowMillis() - stateEntry->since >= stateMachine->timeout) {
+            ESP_LOGW(TAG, "state %u timed out after %u ms", (unsigned)*recordedState, (unsigned)stateMachine->timeout);
+            *recordedState = stateMachine->onTimeout != nullptr ? stateMachine->onTimeout() : stateMachine->timeoutState;
+        } else {
+            // 時間待ちの状態ではコマンドの応答を待っているときだけ受信し、それ以外の行は次の状態に残す
+            const bool readLine = stateMachine->timed ? this->commandEngine.busy() && this->serial_.available() > 0 : (stateMachine->read == false || this->serial_.available());
+            this->rxLine.clear();
+            const bool received = readLine && this->serial_.available() > 0 && this->receiveLine();
+            // 受信行の種別はここで1回だけ判定し、コマンドの応答待ちと各状態の処理に渡す
+            const SkLine line(this->rxLine);
+            bool consumed = false;
+            if (received) {
+                observeLine(line);
+                consumed = this->commandEngine.onLine(line, nowMillis());
             }
-            ESP_LOGD(TAG, "<< %s", rxBuffer.c_str());
-            ESP_LOGD(TAG, "current state : %u", *recordedState);
-            *recordedState = stateMachine->processor(rxBuffer, callback);
-            ESP_LOGD(TAG, "next state : %u", *recordedState);
+            this->commandEngine.poll(nowMillis());
+            if (stateMachine->timed == true) {
+                if (received && !consumed) {
+                    ESP_LOGD(TAG, "Line while waiting for command response : %s", line.text().c_str());
+                    this->metrics.increment(Metrics::Counter::UnexpectedLines);
+                }
+                *recordedState = stateMachine->processor(received && !consumed ? line : SkLine(), callback);
+            } else if (readLine && !(stateMachine->read == true && (line.type == SkLine::Type::Empty || consumed))) {
+                ESP_LOGD(TAG, "current state : %u", (unsigned)*recordedState);
+                *recordedState = stateMachine->processor(line, callback);
+                ESP_LOGD(TAG, "next state : %u", (unsigned)*recordedState);
+            }
+        }
+        if (stateEntry->state != static_cast<int>(*recordedState)) {
+            stateEntry->state = static_cast<int>(*recordedState);
+            stateEntry->since = nowMillis();
         }
     }
     return *recordedState == expectedState;
@@ -533,7 +1292,14 @@ bool BP35A1::initializeLoop(const bool forceReInitialize) {
         ESP_LOGE(TAG, "initializeLoop: state machine is null for state=%d!", (int)this->initializeState);
         return false;
     }
-    const bool result = stateMachineLoop(sm, &this->initializeState, InitializeState::readySmartMeter, nullptr);
+    const bool result = stateMachineLoop(sm, &this->initializeState, &this->initializeStateEntry, InitializeState::readySmartMeter, nullptr);
+    if ((forceReInitialize || this->initializeState == InitializeState::uninitialized) && previousState != InitializeState::uninitialized) {
+        this->metrics.increment(Metrics::Counter::Reinitializations);
+    }
+    if (this->initializeState == InitializeState::readySmartMeter && previousState != InitializeState::readySmartMeter) {
+        this->recoveryPolicy.onSuccess(nowMillis());
+        this->busyRetries = 0;
+    }
     if (this->callback != nullptr && this->initializeState != previousState) {
         this->callback(this->initializeState);
     }
@@ -541,7 +1307,43 @@ bool BP35A1::initializeLoop(const bool forceReInitialize) {
 }
 
 bool BP35A1::communicationLoop(const StateMachineCallback_t callback, const CommunicationState expectedState) {
+    if (this->communicationState == CommunicationState::ready && this->pollScheduler.isInFlight()) {
+        this->pollScheduler.complete(nowMillis(), this->udpSendRequest.answered);
+    }
+    if (this->communicationState == CommunicationState::ready && this->linkQuality.isEdScanInProgress()) {
+        ESP_LOGW(TAG, "ED scan did not complete, discard");
+        this->linkQuality.abandonEdScan();
+    }
+    if (this->communicationState == CommunicationState::ready && this->initializeState == InitializeState::readySmartMeter) {
+        if (this->commandEngine.busy()) {
+            // SKSENDTOなどの応答はコマンドエンジンを通らないため、応答待ちのコマンドと重ねると対応付けがずれる
+        } else if (this->airtimeBudget.reconcileDue(nowMillis())) {
+            this->readRegister(RegisterNum::CumulativeSendingTime, [this](const SkCommandResult &result) {
+                const SkLine esreg = result.lines.empty() ? SkLine() : SkLine(result.lines[0]);
+                if (result.ok() && esreg.type == SkLine::Type::Esreg && esreg.tokenCount == 1) {
+                    this->airtimeBudget.reconcile(nowMillis(), static_cast<uint32_t>(esreg.tokens[0].toUlong()));
+                    ESP_LOGD(TAG, "Cumulative sending time : %s ms, estimate error %d ms", result.lines[0].c_str() + 6, (int)this->airtimeBudget.getLastReconcileError());
+                } else {
+                    ESP_LOGW(TAG, "Failed to read cumulative sending time");
+                    this->airtimeBudget.deferReconcile(nowMillis());
+                }
+            });
+        } else if (this->edScanIntervalMs > 0 && nowMillis() - this->lastEdScan >= this->edScanIntervalMs) {
+            this->communicationState = CommunicationState::edScan;
+        } else if (this->postedRequest.count > 0 || this->postedRequests.pop(this->postedRequest)) {
+            // 送信時間制限で送れなかった要求は持ち越す
+            this->requestEpcs.assign(this->postedRequest.epcs, this->postedRequest.epcs + this->postedRequest.count);
+            if (this->sendPropertyRequest(this->requestEpcs)) {
+                this->postedRequest.count = 0;
+            }
+        } else if (this->pollScheduler.collect(nowMillis(), this->requestEpcs) && this->sendPropertyRequest(this->requestEpcs)) {
+            this->pollScheduler.issue(nowMillis());
+        } else if (this->deepSleepEnabled && !this->pollScheduler.empty() && this->pollScheduler.nextReleaseIn(nowMillis()) >= this->wakeLeadMs + this->minSleepMs) {
+            this->communicationState = CommunicationState::enterSleep;
+        }
+    }
     if (this->communicationState == expectedState) {
+        this->serviceCommandEngine();
         return true;
     }
     const auto *sm = getStateMachine(this->communicationState);
@@ -549,15 +1351,64 @@ bool BP35A1::communicationLoop(const StateMachineCallback_t callback, const Comm
         ESP_LOGE(TAG, "communicationLoop: state machine is null for state=%d!", (int)this->communicationState);
         return false;
     }
-    return stateMachineLoop(sm, &this->communicationState, expectedState, callback);
+    return stateMachineLoop(sm, &this->communicationState, &this->communicationStateEntry, expectedState, callback);
+}
+
+BP35A1::PollResult BP35A1::poll(const StateMachineCallback_t callback, const uint32_t budgetUs, const size_t budgetBytes) {
+    PollResult result;
+    const int64_t startedAt = esp_timer_get_time();
+    const size_t startBytes = this->receivedBytes;
+    while (true) {
+        const InitializeState initializeState       = this->initializeState;
+        const CommunicationState communicationState = this->communicationState;
+        const size_t receivedBytes                  = this->receivedBytes;
+        if (this->initializeState != InitializeState::readySmartMeter) {
+            this->initializeLoop();
+        } else {
+            this->communicationLoop(callback, CommunicationState::ready);
+        }
+        // 状態が変わらず受信行もなければ、時間待ちか受信待ちで進める仕事はない
+        if (this->initializeState == initializeState && this->communicationState == communicationState && this->receivedBytes == receivedBytes) {
+            break;
+        }
+        result.steps++;
+        if (esp_timer_get_time() - startedAt >= budgetUs || this->receivedBytes - startBytes >= budgetBytes) {
+            result.more = true;
+            break;
+        }
+    }
+    const int available = this->serial_.available();
+    result.pendingBytes = available > 0 ? static_cast<size_t>(available) : 0;
+    return result;
 }
 
 void BP35A1::sendUdpData(const uint8_t *const data, const uint16_t length) {
-    skSendTo udpData = skSendTo(length, this->CommunicationParameter.ipv6Address);
-    this->serial_.print(udpData.getSendString());
+    udpSendRequest.data.assign(data, data + length);
+    // 要求毎にTIDを変え、以前の要求への遅れた応答と区別できるようにする
+    if (length >= 4 && data[0] == 0x10 && data[1] == 0x81) {
+        transactionId++;
+        udpSendRequest.data[2] = static_cast<uint8_t>(transactionId >> 8);
+        udpSendRequest.data[3] = static_cast<uint8_t>(transactionId);
+    }
+    udpSendRequest.attempts = 0;
+    udpSendRequest.answered = false;
+    udpSendReceivedOk = udpSendReceivedComplete = false;
+    transmitUdpData();
+}
+
+void BP35A1::transmitUdpData() {
+    const uint8_t *const data = udpSendRequest.data.data();
+    const uint16_t length     = static_cast<uint16_t>(udpSendRequest.data.size());
+    udpSendRequest.attempts++;
+    this->metrics.increment(Metrics::Counter::UdpSends);
+    udpSendRequest.sentAt = nowMillis();
+    this->airtimeBudget.record(nowMillis(), AirtimeBudget::estimateAirtimeMs(length));
+
+    char header[96];
+    const size_t headerLength = skSendTo::format(header, sizeof(header), this->CommunicationParameter.ipv6Address.c_str(), length);
+    this->serial_.write(reinterpret_cast<const uint8_t *>(header), headerLength);
     this->serial_.write(data, length);
     this->serial_.print("\r\n");
-    this->serial_.flush();
 
     constexpr size_t LOG_BUF_SIZE = 128;
     char logBuffer[LOG_BUF_SIZE]  = {'\0'};
@@ -565,16 +1416,36 @@ void BP35A1::sendUdpData(const uint8_t *const data, const uint16_t length) {
     for (size_t i = 0; i < maxBytes; i++) {
         snprintf(&logBuffer[i * 2], LOG_BUF_SIZE - (i * 2) - 2, "%02X", data[i]);
     }
-    ESP_LOGD(TAG, ">> %s%s", udpData.getSendString().c_str(), logBuffer);
+    ESP_LOGD(TAG, ">> %s%s", header, logBuffer);
 }
 
-void BP35A1::sendPropertyRequest(const std::vector<uint8_t> &epc_codes) {
-    std::vector<EchonetLite::Property> props;
-    props.reserve(epc_codes.size());
+bool BP35A1::sendPropertyRequest(const std::vector<uint8_t> &epc_codes) {
+    this->requestProperties.clear();
     for (uint8_t code : epc_codes) {
-        props.push_back(static_cast<EchonetLite::Property>(code));
+        this->requestProperties.push_back(static_cast<EchonetLite::Property>(code));
+    }
+    this->echonet.generateGetRequest(this->requestProperties);
+    if (!this->airtimeBudget.canSend(nowMillis(), this->echonet.size())) {
+        ESP_LOGD(TAG, "Sending time budget exhausted, request deferred for %u ms", (unsigned)this->airtimeBudget.waitTime(nowMillis(), this->echonet.size()));
+        return false;
     }
-    this->echonet.generateGetRequest(props);
     this->sendUdpData(this->echonet.getRawData().data(), this->echonet.size());
-    this->communicationState = CommunicationState::waitSuccessUdpSend;
+    this->communicationState     = CommunicationState::waitSuccessUdpSend;
+    this->partialResponseRetries = 0;
+    this->missingProperties.clear();
+    return true;
+}
+
+bool BP35A1::postPropertyRequest(const uint8_t *const epc_codes, const size_t count) {
+    if (count == 0 || count > maxPostedProperties) {
+        return false;
+    }
+    PostedRequest request;
+    request.count = static_cast<uint8_t>(count);
+    memcpy(request.epcs, epc_codes, count);
+    return this->postedRequests.push(request);
+}
+
+PollScheduler::Handle BP35A1::schedulePropertyRequest(const std::vector<uint8_t> &epc_codes, const uint32_t periodMs, const PollScheduler::Priority priority) {
+    return this->pollScheduler.add(epc_codes, periodMs, priority, nowMillis());
 }
@@ -1,9 +1,21 @@
 #pragma once
 
+#include "AirtimeBudget.hpp"
 #include "ErxUdp.hpp"
 #include "Event.hpp"
 #include "ISerialIO.h"
+#include "LinkQuality.hpp"
 #include "LowVoltageSmartElectricEnergyMeter.hpp"
+#include "Metrics.hpp"
+#include "MpscQueue.hpp"
+#include "PollScheduler.hpp"
+#include "PropertyDecoder.hpp"
+#include "RecoveryPolicy.hpp"
+#include "SkCommand.hpp"
+#include "SkLine.hpp"
+#include <array>
+#include <cstdint>
+#include <cstdlib>
 #include <cstdio>
 #include <functional>
 #include <string>
@@ -19,11 +31,24 @@ inline std::string trim(const std::string &s) {
     return s.substr(start, end - start + 1);
 }
 
+/// @brief trim() と同じ処理をsの領域のまま行う(ヒープを確保しない)
+inline void trimInPlace(std::string &s) {
+    const auto end = s.find_last_not_of(" \t\r\n");
+    if (end == std::string::npos) {
+        s.clear();
+        return;
+    }
+    s.erase(end + 1);
+    s.erase(0, s.find_first_not_of(" \t\r\n"));
+}
+
 class BP35A1 {
   public:
     /// @brief Wi-SUNホスト接続状態
     enum class InitializeState : uint8_t {
         uninitialized,
+        waitProbeEinfo,
+        waitProbeEinfoOk,
         waitSKTermEchoBack,
         terminateSKStack,
         resetSKStack,
@@ -32,10 +57,16 @@ class BP35A1 {
         waitDisableEcho,
         getSKInfo,
         waitEinfo,
-        waitEinfoOk,
+        waitEinfoOk, // 使用しない(互換のため残す)
         getSKStackVersion,
         waitEver,
-        waitEverOk,
+        waitEverOk, // 使用しない(互換のため残す)
+        setUartBaudRate,
+        waitSetUartBaudRate,
+        verifyUartBaudRate,
+        waitVerifyUartBaudRate,
+        revertUartBaudRate,
+        waitRevertUartBaudRate,
         setSKStackPassword,
         waitSetSKStackPassword,
         setSKStackId,
@@ -65,18 +96,47 @@ class BP35A1 {
         waitPana,
         readyCommunication,
         waitInitParamSuccessUdpSend,
+        waitInitParamRetryUdpSend,
         waitInitParamErxudp,
         requerySKInfo,
         waitRequeryEinfo,
         readySmartMeter,
+        commandRejected, // コマンドが引数の誤り(FAIL ER04〜ER06)で拒否された。initializeLoop(true) を呼ぶまで止まる
     } initializeState = InitializeState::uninitialized;
 
     enum class CommunicationState {
         ready,
         waitSuccessUdpSend,
+        waitRetryUdpSend,
         waitErxudp,
+        edScan,
+        waitEdScanOk,
+        waitEdScanResult,
+        waitEdScanChannels,
+        enterSleep,
+        waitSleepOk,
+        sleeping,
+        wake,
+        waitWakeSettle,
+        waitWakeInfo,
     } communicationState = CommunicationState::ready;
 
+    enum class RegisterNum : uint8_t {
+        ChannelNumber          = 0x02,
+        PanId                  = 0x03,
+        FrameCounter           = 0x07,
+        PairingId              = 0x0A,
+        AnswerBeaconRequest    = 0x15,
+        PanaSessionLifeTime    = 0x16,
+        AutoReauthentication   = 0x17,
+        MacBroadcastEncryption = 0xA0,
+        IcmpEcho               = 0xA1,
+        LimitSendtime          = 0xFB,
+        CumulativeSendingTime  = 0xFD,
+        EchoBack               = 0xFE,
+        AutoLoad               = 0xFF,
+    };
+
     enum class ScanMode : uint8_t {
         EDScan,
         ActiveScanWithIE = 2,
@@ -85,21 +145,99 @@ class BP35A1 {
 
     using StateMachineCallback_t = std::function<void(const LowVoltageSmartElectricEnergyMeterClass &)>;
 
+    /// @brief スキャンで得たスマートメーターの情報(EPANDESC)と通信先アドレス
+    struct PanDescriptor {
+        std::string channel;
+        std::string channelPage;
+        std::string panId;
+        std::string macAddress;
+        std::string ipv6Address;
+        std::string destIpv6Address;
+        std::string LQI;
+        std::string pairId;
+    };
+
     void setStatusChangeCallback(std::function<void(InitializeState)>);
+    void setUdpSendFailedCallback(std::function<void(uint8_t)>);
+    /// @brief 前回確立したPANAセッションを設定し、次回の初期化時にモジュールが同じPANに参加済みであれば
+    ///        SKTERM/SKRESETとスキャンを省略してそのまま通信を再開する(MCUのみ再起動した場合など)
+    /// @param channel getChannel() で取得した値
+    /// @param panId getPanId() で取得した値
+    /// @param ipv6Address getCommunicationIpv6Address() で取得した値
+    /// @details チャンネル・PAN ID・アドレス以外の項目(LQI, PairIDなど)は空のまま再開する
+    void setWarmAttachSession(const std::string &channel, const std::string &panId, const std::string &ipv6Address);
+    /// @param session getPanDescriptor() で取得した値。再開後はすべての項目を復元する
+    void setWarmAttachSession(const PanDescriptor &session);
     template <class PropertyType>
-    std::enable_if_t<std::is_enum_v<PropertyType> && std::is_same_v<std::underlying_type_t<PropertyType>, uint8_t>>
+    std::enable_if_t<std::is_enum_v<PropertyType> && std::is_same_v<std::underlying_type_t<PropertyType>, uint8_t>, bool>
     sendPropertyRequest(const std::vector<PropertyType> properties) {
         std::vector<uint8_t> codes;
         codes.reserve(properties.size());
         for (const auto &p : properties) {
             codes.push_back(static_cast<uint8_t>(p));
         }
-        this->sendPropertyRequest(codes);
+        return this->sendPropertyRequest(codes);
+    }
+    /// @return 送信時間制限(ARIB STD-T108)の残りが足りず送信を見送った場合はfalse
+    bool sendPropertyRequest(const std::vector<uint8_t> &epc_codes);
+    /// @brief 受信したプロパティを型付きの値で受け取る
+    /// @details Epcは PropertyDecoder::PropertyTraits が定義されたEPC(0xE7 や Property::InstantaneousPower など)。
+    ///          積算電力量は初期化時に取得した係数と単位でkWhに換算される。
+    ///          ハンドラはcommunicationLoop() のコールバックの前に呼ばれる
+    template <auto Epc>
+    void onProperty(std::function<void(const typename PropertyDecoder::PropertyTraits<static_cast<uint8_t>(Epc)>::type &)> handler) {
+        constexpr uint8_t epc  = static_cast<uint8_t>(Epc);
+        constexpr int8_t index = PropertyDecoder::indexTable[epc];
+        static_assert(index >= 0, "EPC must be listed in PropertyDecoder::supportedEpcs");
+        using Traits = PropertyDecoder::PropertyTraits<epc>;
+        if (handler == nullptr) {
+            this->propertyHandlers[index] = nullptr;
+            return;
+        }
+        this->propertyHandlers[index] = [handler](const uint8_t *const edt, const uint8_t pdc, const PropertyDecoder::Scale &scale) {
+            typename Traits::type value;
+            if (Traits::decode(edt, pdc, scale, &value)) {
+                handler(value);
+            }
+        };
     }
-    void sendPropertyRequest(const std::vector<uint8_t> &epc_codes);
+    /// @brief 他のタスクからプロパティ要求を登録する(スレッドセーフ)
+    /// @details 要求はキューに入り、通信待機中にcommunicationLoop() が順に送信する。
+    ///          応答はcommunicationLoop() のコールバックに渡される
+    /// @return キューが満杯、またはEPCがmaxPostedProperties個を超える場合はfalse
+    bool postPropertyRequest(const uint8_t *epc_codes, size_t count);
+    bool postPropertyRequest(const std::vector<uint8_t> &epc_codes) {
+        return this->postPropertyRequest(epc_codes.data(), epc_codes.size());
+    }
+    /// @brief プロパティを定期取得する。communicationLoop() が通信待機中に期限の来たものからGetを送信し、
+    ///        応答はcommunicationLoop() のコールバックに渡される
+    /// @return getPollScheduler().remove() に渡すハンドル
+    PollScheduler::Handle schedulePropertyRequest(const std::vector<uint8_t> &epc_codes, uint32_t periodMs, PollScheduler::Priority priority = PollScheduler::Priority::Normal);
     BP35A1(std::string, std::string, ISerialIO &);
     bool initializeLoop(const bool forceReInitialize = false);
     bool communicationLoop(StateMachineCallback_t const, const CommunicationState);
+    /// @brief poll() の結果
+    struct PollResult {
+        uint16_t steps      = 0;     // 処理した受信行と状態遷移の数
+        size_t pendingBytes = 0;     // 未処理の受信データ[byte]
+        bool more           = false; // 予算を使い切って打ち切った。すぐに呼び直せば続きを処理できる
+    };
+    /// @brief 予算の範囲で受信行の処理と状態遷移を続けて行う
+    /// @details 初期化が完了するまではinitializeLoop()、完了後はcommunicationLoop() を繰り返し、
+    ///          受信待ち・時間待ちで進める仕事がなくなるか予算を使い切ったら戻る。
+    ///          受信は終端まで届いた行だけを処理し、送信の完了も待たない
+    /// @param budgetUs 処理時間の上限[us]。少なくとも1回は処理する
+    /// @param budgetBytes 処理する受信データの上限[byte]
+    PollResult poll(StateMachineCallback_t const callback, uint32_t budgetUs, size_t budgetBytes = SIZE_MAX);
+    /// @brief SKSTACKコマンドを送信する。結果はOK/FAIL(ERコード)と応答行(EINFO, EVER, ESREG...)で返る
+    /// @details setMaxOutstandingCommands() の数まで応答を待たずに続けて送信する。
+    ///          応答はinitializeLoop() / communicationLoop() の中で処理される
+    SkCommandFuture submitCommand(const std::string &command, SkCommandEngine::Callback done = nullptr, SkCommandResult::Terminator terminator = SkCommandResult::Terminator::Ok);
+    SkCommandFuture readRegister(RegisterNum, SkCommandEngine::Callback done = nullptr);
+    SkCommandFuture writeRegister(RegisterNum, const std::string &value, SkCommandEngine::Callback done = nullptr);
+    void setMaxOutstandingCommands(size_t maxOutstanding) {
+        this->commandEngine.setMaxOutstanding(maxOutstanding);
+    }
     InitializeState getInitializeState() const;
     CommunicationState getCommunicationState() const;
     void resetInitializeState();
@@ -123,8 +261,9 @@ class BP35A1 {
     const std::string &getChannel() const {
         return CommunicationParameter.channel;
     }
+    /// @return 未取得の場合は0
     uint8_t getChannelNumeric() const {
-        return static_cast<uint8_t>(std::stoul(this->CommunicationParameter.channel, nullptr, 10));
+        return static_cast<uint8_t>(strtoul(this->CommunicationParameter.channel.c_str(), nullptr, 10));
     }
     const std::string &getPanId() const {
         return CommunicationParameter.panId;
@@ -132,17 +271,95 @@ class BP35A1 {
     const std::string &getLQI() const {
         return CommunicationParameter.LQI;
     }
+    /// @return 未取得の場合は0
     uint8_t getLQINumeric() const {
-        return static_cast<uint8_t>(std::stoul(this->CommunicationParameter.LQI, nullptr, 16));
+        return static_cast<uint8_t>(strtoul(this->CommunicationParameter.LQI.c_str(), nullptr, 16));
     }
     const std::string &getPairId() const {
         return CommunicationParameter.pairId;
     }
+    const PanDescriptor &getPanDescriptor() const {
+        return CommunicationParameter;
+    }
     ScanMode getScanMode() const {
         return scanMode;
     }
     uint32_t getPanaFailCount() const {
-        return pana_fail_count_;
+        return metrics.get(Metrics::Counter::PanaFailures);
+    }
+    uint32_t getUdpSendRetryCount() const {
+        return metrics.get(Metrics::Counter::UdpSendRetries);
+    }
+    uint32_t getUdpSendFailCount() const {
+        return metrics.get(Metrics::Counter::UdpSendFailures);
+    }
+    /// @brief SKSENDTO失敗時(EVENT 21 パラメータ01)の再送設定
+    /// @param maxAttempts 初回送信を含む最大送信回数
+    /// @param backoffMs 初回再送までの待ち時間。再送毎に倍増し、backoffMaxMsで頭打ち
+    void setUdpSendRetry(uint8_t maxAttempts, uint32_t backoffMs, uint32_t backoffMaxMs) {
+        this->udpSendMaxAttempts  = maxAttempts > 0 ? maxAttempts : 1;
+        this->udpSendBackoffMs    = backoffMs;
+        this->udpSendBackoffMaxMs = backoffMaxMs;
+    }
+    /// @brief Get_SNA(0x52)で一部のプロパティが得られなかったとき、そのEPCだけを問い合わせ直す回数
+    void setPartialResponseRetry(uint8_t maxRetries) {
+        this->maxPartialResponseRetries = maxRetries;
+    }
+    /// @brief 直前に受信した応答(Get_SNA)で値が得られなかったEPC。コールバック内で参照する
+    const std::vector<uint8_t> &getMissingProperties() const {
+        return missingProperties;
+    }
+    /// @brief ゲージを現在値に更新したメトリクスを返す
+    const Metrics &getMetrics();
+    AirtimeBudget &getAirtimeBudget() {
+        return airtimeBudget;
+    }
+    LinkQuality &getLinkQuality() {
+        return linkQuality;
+    }
+    PollScheduler &getPollScheduler() {
+        return pollScheduler;
+    }
+    RecoveryPolicy &getRecoveryPolicy() {
+        return recoveryPolicy;
+    }
+    /// @brief 通信待機中に定期的にEDスキャンを行い、リンク劣化時は静かなチャンネルに絞って再スキャンする
+    /// @param intervalMs EDスキャン間隔。0で無効
+    /// @param quietThreshold 受信エネルギー(LQI)がこれ以下のチャンネルを静かなチャンネルとみなす
+    void setBackgroundEdScan(uint32_t intervalMs, uint8_t quietThreshold) {
+        this->edScanIntervalMs = intervalMs;
+        this->edQuietThreshold = quietThreshold;
+    }
+    /// @brief ホスト側で求めた値をモジュールにも問い合わせて確認する
+    /// @details 通常はスマートメーターのリンクローカルアドレスをMACアドレスから求めてSKLL64を省略し、
+    ///          JOIN後のSKINFOも既知の値で埋めて再問い合わせしない。
+    ///          trueにすると両方をモジュールに問い合わせ、食い違えばモジュールの値を使う
+    void setVerifyDerivedValues(bool verify) {
+        this->verifyDerivedValues = verify;
+    }
+    /// @brief 定期取得(schedulePropertyRequest)の合間にモジュールをスリープさせる
+    /// @details 次の取得までwakeLeadMs + minSleepMs以上空くときにSKDSLEEPで眠らせ、
+    ///          取得のwakeLeadMs前にUARTへの送信で起こしてSKINFOでセッションを確認する
+    /// @param wakeLeadMs 取得予定時刻の何ms前に起こすか
+    /// @param minSleepMs これより短い空き時間では眠らせない
+    void setDeepSleep(bool enable, uint32_t wakeLeadMs = 200, uint32_t minSleepMs = 1000) {
+        this->deepSleepEnabled = enable;
+        this->wakeLeadMs       = wakeLeadMs;
+        this->minSleepMs       = minSleepMs;
+    }
+    /// @brief スリープ中のモジュールを起こす(次のcommunicationLoop()から)
+    void wakeUp() {
+        this->wakeRequested = true;
+    }
+    /// @brief 起床開始から通信可能になるまでの時間[ms]
+    const LinkQuality::Average &getWakeLatency() const {
+        return wakeLatency;
+    }
+    /// @brief 初期化時にモジュールとホストのUART速度をbaudRateに切り替える
+    /// @details WUARTで設定してからISerialIO::setBaudRate() でホスト側を合わせ、SKVERで疎通を確認する。
+    ///          応答がなければ元の速度に戻す。BP35A1の上限は115200bps。0で無効
+    void setUartBaudRate(uint32_t baudRate) {
+        this->uartBaudRate = baudRate;
     }
     void setScanChannelMask(unsigned int mask) {
         this->scanChannelMask = mask;
@@ -162,8 +379,28 @@ class BP35A1 {
 
   private:
     static constexpr const char *const TAG = "bp35a1";
+    static constexpr uint32_t wakeSettleMs = 50;  // 起床の送信からコマンドを受け付けるまでの待ち時間
+    static constexpr uint8_t maxWakeAttempts = 3;
+    static constexpr uint8_t maxUartVerifyAttempts = 2;
+    static constexpr uint8_t maxBusyRetries        = 3; // FAIL ER09 / ER10 をすぐに送り直す回数
     LowVoltageSmartElectricEnergyMeterClass echonet;
-    unsigned int scanChannelMask = 0xFFFFFFFF;
+    AirtimeBudget airtimeBudget;
+    Metrics metrics;
+    LinkQuality linkQuality;
+    PollScheduler pollScheduler;
+
+    static constexpr size_t maxPostedProperties = 16;
+    struct PostedRequest {
+        uint8_t count = 0;
+        uint8_t epcs[maxPostedProperties];
+    };
+    MpscQueue<PostedRequest, 8> postedRequests;
+    PostedRequest postedRequest; // キューから取り出し、送信を待っている要求
+    RecoveryPolicy recoveryPolicy;
+    std::vector<uint8_t> requestEpcs;                     // 送信するEPC(領域を使い回す)
+    std::vector<EchonetLite::Property> requestProperties; // generateGetRequest() に渡すプロパティ(領域を使い回す)
+    unsigned int scanChannelMask   = 0xFFFFFFFF; // setScanChannelMask() で設定したスキャン対象
+    unsigned int rescanChannelMask = 0;          // 次の1回のスキャンだけに使うスキャン対象(EDスキャンで選んだ空きチャンネル)。0で無効
 
     ScanMode scanMode = ScanMode::ActiveScanWithIE;
 
@@ -181,6 +418,8 @@ class BP35A1 {
         "SKRESET",
         "ROPT",
         "WOPT",
+        "SKDSLEEP",
+        "WUART",
     };
 
     enum SKCmd {
@@ -197,66 +436,101 @@ class BP35A1 {
         resetSKStack,       // SKスタックのリセット
         readOpt,            // WOPT コマンドの設定状態を表示します。
         writeOpt,           // ERXUDP、ERXTCP のデータ部の表示形式を設定します。
+        deepSleep,          // スリープモードに移行します。
+        writeUart,          // UARTの通信速度を設定します。
     };
 
     template <class StateType>
     struct StateMachine {
         const StateType state;
         const bool read;
-        const std::function<StateType(const std::string &, const StateMachineCallback_t)> processor;
+        const bool timed = false; // 受信を待たず毎ループprocessorを呼ぶ(時間待ち用)
+        const uint32_t timeout = 0; // この時間[ms]状態が変わらなければtimeoutStateへ遷移する。0で無効
+        const StateType timeoutState = StateType();
+        const std::function<StateType()> onTimeout = nullptr; // 指定した場合はタイムアウト時の遷移先をtimeoutStateの代わりに決める
+        const std::function<StateType(const SkLine &, const StateMachineCallback_t)> processor;
     };
 
-    enum class RegisterNum : uint8_t {
-        ChannelNumber          = 0x02,
-        PanId                  = 0x03,
-        FrameCounter           = 0x07,
-        PairingId              = 0x0A,
-        AnswerBeaconRequest    = 0x15,
-        PanaSessionLifeTime    = 0x16,
-        AutoReauthentication   = 0x17,
-        MacBroadcastEncryption = 0xA0,
-        IcmpEcho               = 0xA1,
-        LimitSendtime          = 0xFB,
-        CumulativeSendingTime  = 0xFD,
-        EchoBack               = 0xFE,
-        AutoLoad               = 0xFF,
+    /// @brief 送信コマンドとOK待ちの2状態を生成するための定義
+    struct CommandStep {
+        const InitializeState send;
+        const InitializeState wait;
+        const std::function<std::string()> command; // 空文字列を返した場合は送信せずにsuccessへ進む
+        const InitializeState success;
+        /// @brief 応答から遷移先を決める(成功・失敗とも)。指定しなければ成功でsuccess、失敗でonCommandFailure()
+        const std::function<InitializeState(const SkCommandResult &)> complete = nullptr;
+        const SkCommandResult::Terminator terminator                            = SkCommandResult::Terminator::Ok;
     };
-    size_t settingRegister(const RegisterNum, const std::string &);
+
+    std::string makeCommand(const SKCmd, const std::string *const = nullptr) const;
+    std::string makeRegisterCommand(const RegisterNum, const std::string *const = nullptr) const;
+    void observeLine(const SkLine &);
+    /// @brief 1行をrxLineに読み込む。rxLineの領域を使い回すため、定常状態ではヒープを確保しない
+    /// @return 空行でなければtrue
+    bool receiveLine();
+    /// @brief スマートメーターからのERXUDPか(文字列を連結せずに比較する)
+    bool isErxUdpFromMeter(const SkLine &) const;
+    /// @brief EINFOの各項目をskinfoに保存する
+    void setSkInfo(const SkLine &);
+    void dispatchProperties();
+    void reselectChannel();
+    void setInitializeState(const InitializeState);
+    /// @brief 失敗時の遷移先を復旧段階に応じて決める
+    /// @param retryState 再送時の遷移先
+    /// @param minimumTier この段階より軽い復旧は行わない
+    InitializeState recover(const InitializeState retryState, const RecoveryPolicy::Tier minimumTier = RecoveryPolicy::Tier::Retry);
+    /// @brief コマンドが失敗したときの遷移先をエラーコードに応じて決める
+    /// @details ER09 / ER10 は復旧段階を進めずにすぐ送り直し、ER04〜ER06 は送り直さずにcommandRejectedで止める
+    /// @param errorCode FAIL ERxx の xx。FAIL以外の失敗(タイムアウトなど)は0
+    InitializeState onCommandFailure(const uint8_t errorCode, const InitializeState resend);
+    /// @brief 応答待ちの状態で期待した行以外を受け取ったときの遷移先を決める
+    /// @details コマンドの応答ではない非同期の行(EVENTなど)は無視して待ち続ける
+    InitializeState onUnexpectedResponse(const SkLine &, const InitializeState waiting, const InitializeState resend);
+    /// @brief 係数・積算電力量単位の取得に失敗したときの遷移先を決める
+    /// @details ウォームアタッチ中はreadyCommunicationで再送回数を数えてコールドスタートに切り替え、それ以外は復旧段階を進める
+    InitializeState onInitParamFailure();
     size_t execCommand(const SKCmd, const std::string *const = nullptr);
     void sendUdpData(const uint8_t *const, const uint16_t);
+    void transmitUdpData();
 
-    template <class StateType>
-    bool stateMachineLoop(const StateMachine<StateType> *const, StateType *const, const StateType, const StateMachineCallback_t);
+    /// @brief 状態の滞在時間の計測用
+    struct StateEntry {
+        int state      = -1;
+        uint32_t since = 0;
+    };
 
-    std::vector<std::string> splitString(const std::string &str, char delimiter) {
-        std::vector<std::string> tokens;
-        size_t start = 0;
-        size_t end   = str.find(delimiter);
-        while (end != std::string::npos) {
-            tokens.push_back(str.substr(start, end - start));
-            start = end + 1;
-            end   = str.find(delimiter, start);
-        }
-        tokens.push_back(str.substr(start));
-        return tokens;
-    }
+    template <class StateType>
+    bool stateMachineLoop(const StateMachine<StateType> *const, StateType *const, StateEntry *const, const StateType, const StateMachineCallback_t);
 
     ISerialIO &serial_;
+    SkCommandEngine commandEngine;
+    SkCommandFuture pendingCommand;
     std::string eVer;
     std::string WPassword;
     std::string WID;
 
-    std::function<void(InitializeState)> callback; // BP35A1のステータス変更を通知するコールバック
+    std::function<void(InitializeState)> callback;           // BP35A1のステータス変更を通知するコールバック
+    std::function<void(uint8_t)> udpSendFailedCallback;      // 再送上限に達したUDP送信を通知するコールバック
+    PanDescriptor CommunicationParameter;
+
+    /// @brief 送信中のUDPリクエスト(再送用に送信データを保持する)
     struct {
-        std::string channel;
-        std::string channelPage;
-        std::string panId;
-        std::string macAddress;
-        std::string ipv6Address;
-        std::string destIpv6Address;
-        std::string LQI;
-        std::string pairId;
-    } CommunicationParameter;
+        std::vector<uint8_t> data;
+        uint8_t attempts = 0;
+        uint32_t retryAt = 0;
+        uint32_t sentAt  = 0;
+        bool answered    = false;
+    } udpSendRequest;
+
+    std::string rxLine;                     // 受信した行(領域を使い回す)
+    size_t receivedBytes = 0;               // 受信した行の累計[byte](poll() の予算の計算用)
+    ErxUdp erxUdp;                          // 受信したERXUDP(領域を使い回す)
+    std::vector<uint8_t> erxUdpData;        // 受信したERXUDPのデータ部(バイナリ)
+    std::vector<uint8_t> missingProperties; // Get_SNAで値が得られなかったEPC
+
+    using PropertyHandler = std::function<void(const uint8_t *const, const uint8_t, const PropertyDecoder::Scale &)>;
+    std::array<PropertyHandler, PropertyDecoder::supportedCount> propertyHandlers; // onProperty() で登録したハンドラ(supportedEpcsの順)
+    PropertyDecoder::Scale propertyScale;
 
     struct {
         std::string ipv6Address;
@@ -266,22 +540,53 @@ class BP35A1 {
         std::string macAddress16;
     } skinfo;
 
+    PanDescriptor warmAttachSession; // ウォームアタッチで再開を試みるセッション
+
+    StateEntry initializeStateEntry;
+    StateEntry communicationStateEntry;
+
     // lambda内のstatic変数をメンバ化：状態リセット時に初期化可能にする
-    bool udpSendReceivedOk       = false;
-    bool udpSendReceivedComplete = false;
-    bool disableEchoReceivedOk   = false;
-    bool disableEchoReceivedEcho = false;
-    uint32_t pana_fail_count_    = 0;
-    uint32_t scanDuration        = 3;
-    bool scanReceivedBeacon      = false;
-    bool scanReceivedEpanDesc    = false;
+    bool udpSendReceivedOk            = false;
+    bool udpSendReceivedComplete      = false;
+    uint16_t transactionId            = 0; // 最後に送信したECHONET Lite電文のTID
+    uint8_t udpSendMaxAttempts        = 4;
+    uint32_t udpSendBackoffMs         = 100;
+    uint32_t udpSendBackoffMaxMs      = 1600;
+    uint32_t scanDuration             = 3;
+    bool scanReceivedBeacon           = false;
+    bool scanReceivedEpanDesc         = false;
+    bool warmAttachPending            = false;
+    bool warmAttaching                = false;
+    bool verifyDerivedValues          = false;
+    uint8_t warmAttachRequests        = 0;
+    uint32_t edScanIntervalMs         = 0;
+    uint32_t lastEdScan               = 0;
+    uint8_t edQuietThreshold          = 0x30;
+    uint8_t partialResponseRetries    = 0;
+    uint8_t maxPartialResponseRetries = 2;
+    bool deepSleepEnabled             = false;
+    bool wakeRequested                = false;
+    uint32_t wakeLeadMs               = 200;
+    uint32_t minSleepMs               = 1000;
+    uint32_t wakeStartedAt            = 0;
+    uint32_t wakeSignalAt             = 0;
+    uint8_t wakeAttempts              = 0;
+    uint32_t uartBaudRate             = 0;
+    uint32_t previousUartBaudRate     = 0;
+    uint8_t uartVerifyAttempts        = 0;
+    uint8_t busyRetries               = 0;
+    InitializeState busyRetryState    = InitializeState::uninitialized;
+    LinkQuality::Average wakeLatency;
     const StateMachine<InitializeState> *getStateMachine(const InitializeState);
     const StateMachine<CommunicationState> *getStateMachine(const CommunicationState);
     template <class StateType>
     const StateMachine<StateType> *findStateMachine(const std::vector<StateMachine<StateType>> *const, const StateType);
     template <class StateType>
-    StateType checkSuccessUdpSend(const std::string &, const StateType, const StateType);
+    StateType checkSuccessUdpSend(const SkLine &, const StateType, const StateType, const StateType, const StateType);
+    template <class StateType>
+    StateType retryUdpSend(const StateType, const StateType);
     void buildStateMachine();
+    void serviceCommandEngine();
 
     std::vector<StateMachine<InitializeState>> init_state_machines_;
     std::vector<StateMachine<CommunicationState>> comm_state_machines_;
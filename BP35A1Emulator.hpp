@@ -0,0 +1,649 @@
+#pragma once
+
+#include "AirtimeBudget.hpp"
+#include "ISerialIO.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+/// @brief BP35A1(SKSTACK IP)と低圧スマート電力量メータのエミュレータ
+/// @details ホスト環境でBP35A1クラスを動かすためのISerialIO実装。
+///          SKSTACKのコマンドに応答し、SKSENDTOで送られたECHONET Lite Getに対して
+///          設定した遅延・損失・不可応答(Get_SNA)でGet_ResをERXUDPとして返す。INFの定期通知も行う。
+///          時刻はsetClock()で差し替えられる(既定はstd::chrono::steady_clock)。
+class BP35A1Emulator : public ISerialIO {
+  public:
+    struct Config {
+        uint32_t commandLatencyMs    = 1;    // コマンドの応答時間
+        uint32_t scanTimeMs          = 100;  // SKSCAN 1チャンネル当たりの時間
+        uint32_t joinTimeMs          = 200;  // SKJOINからEVENT 25まで
+        uint32_t sendTimeMs          = 20;   // SKSENDTOからEVENT 21まで
+        uint32_t responseLatencyMs   = 50;   // EVENT 21からERXUDPまで
+        uint32_t latencyJitterMs     = 20;   // 応答時間のばらつき(一様分布)
+        float sendFailureRate        = 0.0f; // EVENT 21 パラメータ01で返す割合
+        float responseLossRate       = 0.0f; // 送信は成功したがメータが応答しない割合
+        float partialResponseRate    = 0.0f; // Get_SNA(0x52)で一部プロパティを欠落させる割合
+        uint32_t infIntervalMs       = 0;    // 定時積算電力量(0xEA)のINF通知間隔。0で無効
+        bool panaSuccess             = true; // falseでEVENT 24(PANA認証失敗)を返す
+        uint8_t channel              = 0x21;
+        uint16_t panId               = 0x8888;
+        uint8_t lqi                  = 0xA0;
+        std::string meterMac         = "001D129000030C89";
+        std::string moduleMac        = "001D129012345678";
+        std::string version          = "1.2.10";
+        uint32_t airtimeLimitMs      = 0; // 累積送信時間がこれを超えるとEVENT 32を返す。0で無効
+        uint32_t seed                = 1;
+        uint32_t wakeTimeMs          = 30;     // スリープ中のUART受信から受け付け可能になるまで。それまでの受信は捨てる
+        float supplyVoltage          = 3.3f;   // 消費エネルギーの見積もり用
+        float rxCurrentMa            = 30.0f;  // 待ち受け(受信)時の電流
+        float txCurrentMa            = 47.0f;  // 送信時の電流
+        float sleepCurrentMa         = 0.006f; // SKDSLEEP中の電流
+        uint32_t baudRate            = 115200; // モジュールとホストの初期UART速度
+        bool uartAppliesImmediately  = true;   // falseでWUARTを保存のみとし、速度は変えない
+        float busyRate               = 0.0f;   // コマンドを実行せずFAIL ER10で返す割合
+        float strayEventRate         = 0.0f;   // コマンドの応答の前に無関係なEVENTを挟む割合
+    };
+
+    struct Stats {
+        uint32_t requests         = 0;
+        uint32_t responses        = 0;
+        uint32_t partialResponses = 0;
+        uint32_t lostResponses    = 0;
+        uint32_t failedSends      = 0;
+        uint32_t busyFailures     = 0;
+        uint32_t infNotifications = 0;
+        uint32_t sleeps           = 0;
+        uint32_t wakeups          = 0;
+        uint32_t sleepMs          = 0; // 起床済みのスリープ期間の合計
+        std::map<std::string, uint32_t> commands; // コマンド名毎の受信回数
+    };
+
+    /// @brief 応答時間の記録とパーセンタイル計算(ベンチマーク用)
+    class LatencyRecorder {
+      public:
+        void add(const uint32_t ms) {
+            samples.push_back(ms);
+            sorted = false;
+        }
+        /// @param p 0.0 - 1.0
+        uint32_t percentile(const float p) {
+            if (samples.empty()) {
+                return 0;
+            }
+            if (!sorted) {
+                std::sort(samples.begin(), samples.end());
+                sorted = true;
+            }
+            const size_t index = static_cast<size_t>(p * (samples.size() - 1) + 0.5f);
+            return samples[index < samples.size() ? index : samples.size() - 1];
+        }
+        size_t count() const {
+            return samples.size();
+        }
+        void clear() {
+            samples.clear();
+        }
+
+      private:
+        std::vector<uint32_t> samples;
+        bool sorted = false;
+    };
+
+    BP35A1Emulator()
+        : BP35A1Emulator(Config()) {}
+
+    explicit BP35A1Emulator(const Config &config)
+        : config(config), rng(config.seed), hostBaudRate(config.baudRate), moduleBaudRate(config.baudRate), persistedBaudRate(config.baudRate) {
+        clock = []() {
+            return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+        };
+        startedAt  = now();
+        properties = {
+            {0x80, {0x30}},                                                             // 動作状態
+            {0xD3, {0x00, 0x00, 0x00, 0x01}},                                           // 係数
+            {0xD7, {0x06}},                                                             // 積算電力量有効桁数
+            {0xE0, {0x00, 0x01, 0x86, 0xA0}},                                           // 積算電力量計測値(正方向)
+            {0xE1, {0x01}},                                                             // 積算電力量単位 0.1kWh
+            {0xE3, {0x00, 0x00, 0x00, 0x10}},                                           // 積算電力量計測値(逆方向)
+            {0xE7, {0x00, 0x00, 0x01, 0xF4}},                                           // 瞬時電力計測値 500W
+            {0xE8, {0x00, 0x32, 0x00, 0x14}},                                           // 瞬時電流計測値 R5.0A T2.0A
+            {0xEA, {0x07, 0xEA, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x01, 0x86, 0xA0}}, // 定時積算電力量計測値(正方向)
+        };
+    }
+
+    void setClock(std::function<uint32_t()> clock) {
+        this->clock = std::move(clock);
+        startedAt   = now();
+    }
+
+    bool isSleeping() const {
+        return sleeping;
+    }
+
+    /// @brief setClock() 以降のモジュールの消費エネルギー[mJ]の見積もり
+    /// @details 送信時間(SFD相当)は送信電流、スリープ中はスリープ電流、それ以外は待ち受け電流で積算する
+    float energyMillijoules() const {
+        const uint32_t t       = now();
+        const uint32_t asleep  = stats.sleepMs + (sleeping ? t - sleepStartedAt : 0);
+        const uint32_t elapsed = t - startedAt;
+        const uint32_t awake   = elapsed > asleep ? elapsed - asleep : 0;
+        const uint32_t tx      = std::min(cumulativeSendingTime, awake);
+        return config.supplyVoltage * (config.rxCurrentMa * (awake - tx) + config.txCurrentMa * tx + config.sleepCurrentMa * asleep) / 1000.0f;
+    }
+
+    /// @brief プロパティ値(EDT)を設定する
+    void setProperty(const uint8_t epc, const std::vector<uint8_t> &edt) {
+        properties[epc] = edt;
+    }
+
+    Config &getConfig() {
+        return config;
+    }
+
+    const Stats &getStats() const {
+        return stats;
+    }
+
+    static std::string macToIpv6(const std::string &mac) {
+        char s[40];
+        const unsigned long long m = strtoull(mac.c_str(), nullptr, 16) ^ 0x0200000000000000ULL;
+        snprintf(s, sizeof(s), "FE80:0000:0000:0000:%04X:%04X:%04X:%04X", (unsigned)(m >> 48) & 0xFFFF, (unsigned)(m >> 32) & 0xFFFF, (unsigned)(m >> 16) & 0xFFFF, (unsigned)m & 0xFFFF);
+        return std::string(s);
+    }
+
+    std::string meterIpv6() const {
+        return macToIpv6(config.meterMac);
+    }
+
+    std::string moduleIpv6() const {
+        return macToIpv6(config.moduleMac);
+    }
+
+    // ISerialIO
+    virtual size_t write(uint8_t data) {
+        receive(reinterpret_cast<const char *>(&data), 1);
+        return 1;
+    }
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        receive(reinterpret_cast<const char *>(buffer), size);
+        return size;
+    }
+    virtual int read() {
+        deliver();
+        if (rx.empty()) {
+            return -1;
+        }
+        const int c = static_cast<uint8_t>(rx.front());
+        rx.pop_front();
+        return c;
+    }
+    virtual int available() {
+        deliver();
+        return static_cast<int>(rx.size());
+    }
+    virtual void flush() {}
+    virtual size_t print(const std::string &data) {
+        receive(data.data(), data.size());
+        return data.size();
+    }
+    virtual size_t println(const std::string &data) {
+        return print(data) + print("\r\n");
+    }
+    virtual std::string readStringUntil(char terminator) {
+        deliver();
+        std::string ret;
+        while (!rx.empty()) {
+            const char c = rx.front();
+            rx.pop_front();
+            if (c == terminator) {
+                break;
+            }
+            ret += c;
+        }
+        return ret;
+    }
+    virtual bool readLine(std::string &line, char terminator) {
+        deliver();
+        line.clear();
+        while (!rx.empty()) {
+            const char c = rx.front();
+            rx.pop_front();
+            if (c == terminator) {
+                break;
+            }
+            line += c;
+        }
+        return !line.empty();
+    }
+    virtual size_t readBytes(uint8_t *buffer, size_t length) {
+        deliver();
+        size_t i = 0;
+        for (; i < length && !rx.empty(); i++) {
+            buffer[i] = static_cast<uint8_t>(rx.front());
+            rx.pop_front();
+        }
+        return i;
+    }
+    /// @details モジュールと速度が食い違っている間の送受信は捨てる
+    virtual bool setBaudRate(uint32_t baudRate) {
+        hostBaudRate = baudRate;
+        return true;
+    }
+    virtual uint32_t getBaudRate() const {
+        return hostBaudRate;
+    }
+
+    /// @brief WUARTで保存されたUART速度
+    uint32_t getPersistedBaudRate() const {
+        return persistedBaudRate;
+    }
+
+  private:
+    struct Output {
+        uint32_t due;
+        std::string line;
+    };
+
+    uint32_t now() const {
+        return clock();
+    }
+
+    bool chance(const float rate) {
+        return rate > 0.0f && std::uniform_real_distribution<float>(0.0f, 1.0f)(rng) < rate;
+    }
+
+    uint32_t jitter() {
+        return config.latencyJitterMs > 0 ? std::uniform_int_distribution<uint32_t>(0, config.latencyJitterMs)(rng) : 0;
+    }
+
+    /// @brief delay後にモジュールから出力する行を予約する
+    void emit(const uint32_t delay, const std::string &line) {
+        const uint32_t due = now() + delay;
+        auto it            = outputs.end();
+        while (it != outputs.begin() && static_cast<int32_t>(std::prev(it)->due - due) > 0) {
+            --it;
+        }
+        outputs.insert(it, {due, line});
+    }
+
+    void deliver() {
+        const uint32_t t = now();
+        if (config.infIntervalMs > 0 && joined) {
+            if (static_cast<int32_t>(t - nextInf) >= 0) {
+                if (nextInf != 0 && !sleeping) {
+                    sendInf();
+                }
+                nextInf = t + config.infIntervalMs;
+            }
+        }
+        while (!outputs.empty() && static_cast<int32_t>(t - outputs.front().due) >= 0) {
+            if (hostBaudRate != moduleBaudRate) {
+                outputs.pop_front();
+                continue;
+            }
+            for (const char c : outputs.front().line) {
+                rx.push_back(c);
+            }
+            rx.push_back('\r');
+            rx.push_back('\n');
+            outputs.pop_front();
+        }
+    }
+
+    void receive(const char *data, size_t size) {
+        if (sleeping) {
+            sleeping = false;
+            stats.wakeups++;
+            stats.sleepMs += now() - sleepStartedAt;
+            waking  = true;
+            awakeAt = now() + config.wakeTimeMs;
+            return;
+        }
+        if (waking) {
+            if (static_cast<int32_t>(now() - awakeAt) < 0) {
+                return;
+            }
+            waking = false;
+        }
+        if (hostBaudRate != moduleBaudRate) {
+            return;
+        }
+        tx.append(data, size);
+        while (true) {
+            if (tx.compare(0, 9, "SKSENDTO ") == 0) {
+                if (!receiveSendTo()) {
+                    return;
+                }
+                continue;
+            }
+            const size_t end = tx.find("\r\n");
+            if (end == std::string::npos) {
+                return;
+            }
+            const std::string line = tx.substr(0, end);
+            tx.erase(0, end + 2);
+            if (!line.empty()) {
+                command(line);
+            }
+        }
+    }
+
+    /// @return SKSENDTOのデータ部まで受信済みで処理した場合はtrue
+    bool receiveSendTo() {
+        // SKSENDTO <HANDLE> <IPADDR> <PORT> <SEC> <DATALEN> <DATA>
+        size_t pos = 0;
+        for (int i = 0; i < 6; i++) {
+            pos = tx.find(' ', pos);
+            if (pos == std::string::npos) {
+                return false;
+            }
+            pos++;
+        }
+        const std::vector<std::string> args = split(tx.substr(0, pos - 1));
+        const size_t length                 = strtoul(args[5].c_str(), nullptr, 16);
+        if (tx.size() < pos + length) {
+            return false;
+        }
+        const std::vector<uint8_t> data(tx.begin() + pos, tx.begin() + pos + length);
+        tx.erase(0, pos + length);
+        if (tx.compare(0, 2, "\r\n") == 0) {
+            tx.erase(0, 2);
+        }
+        stats.commands["SKSENDTO"]++;
+        sendTo(data);
+        return true;
+    }
+
+    void command(const std::string &line) {
+        const std::vector<std::string> args = split(line);
+        const std::string &name             = args[0];
+        stats.commands[name]++;
+        const uint32_t d = config.commandLatencyMs;
+        if (echo) {
+            emit(0, line);
+        }
+        if (chance(config.strayEventRate)) {
+            emit(0, "EVENT 02 " + meterIpv6());
+        }
+        if (name != "SKRESET" && name != "SKDSLEEP" && name != "WUART" && chance(config.busyRate)) {
+            stats.busyFailures++;
+            emit(d, "FAIL ER10");
+            return;
+        }
+        if (name == "SKRESET") {
+            reset();
+            emit(d, "OK");
+        } else if (name == "SKTERM") {
+            if (joined) {
+                joined = false;
+                emit(d, "OK");
+                emit(d + config.joinTimeMs, "EVENT 27 " + meterIpv6());
+            } else {
+                emit(d, "FAIL ER10");
+            }
+        } else if (name == "SKSREG" && args.size() == 2) {
+            char s[16];
+            snprintf(s, sizeof(s), "ESREG %s", readRegister(args[1]).c_str());
+            emit(d, s);
+            emit(d, "OK");
+        } else if (name == "SKSREG" && args.size() == 3) {
+            writeRegister(args[1], args[2]);
+            emit(d, "OK");
+        } else if (name == "SKINFO") {
+            char s[96];
+            snprintf(s, sizeof(s), "EINFO %s %s %02X %04X FFFE", moduleIpv6().c_str(), config.moduleMac.c_str(), registerChannel, registerPanId);
+            emit(d, s);
+            emit(d, "OK");
+        } else if (name == "SKVER") {
+            emit(d, "EVER " + config.version);
+            emit(d, "OK");
+        } else if (name == "SKSETPWD" || name == "SKSETRBID") {
+            emit(d, "OK");
+        } else if (name == "ROPT") {
+            emit(d, hexOutput ? "OK 01" : "OK 00");
+        } else if (name == "WOPT" && args.size() == 2) {
+            hexOutput = strtoul(args[1].c_str(), nullptr, 16) & 0x01;
+            emit(d, "OK");
+        } else if (name == "SKSCAN" && args.size() >= 4) {
+            scan(args);
+        } else if (name == "SKDSLEEP") {
+            emit(0, "OK");
+            deliver();
+            sleeping       = true;
+            sleepStartedAt = now();
+            stats.sleeps++;
+        } else if (name == "WUART" && args.size() == 2) {
+            constexpr uint32_t baudRates[] = {115200, 2400, 4800, 9600, 19200, 38400, 57600};
+            const uint32_t mode            = strtoul(args[1].c_str(), nullptr, 16);
+            if (mode >= sizeof(baudRates) / sizeof(baudRates[0])) {
+                emit(d, "FAIL ER06");
+                return;
+            }
+            emit(0, "OK");
+            deliver();
+            persistedBaudRate = baudRates[mode];
+            if (config.uartAppliesImmediately) {
+                moduleBaudRate = persistedBaudRate;
+            }
+        } else if (name == "SKLL64" && args.size() == 2) {
+            emit(d, macToIpv6(args[1]));
+        } else if (name == "SKJOIN" && args.size() == 2) {
+            emit(d, "OK");
+            if (config.panaSuccess && args[1] == meterIpv6() && registerChannel == config.channel && registerPanId == config.panId) {
+                emit(d + config.joinTimeMs, "EVENT 25 " + meterIpv6());
+                joinPending = true;
+            } else {
+                emit(d + config.joinTimeMs, "EVENT 24 " + meterIpv6());
+            }
+        } else {
+            emit(d, "FAIL ER04");
+        }
+        if (joinPending) {
+            joinPending = false;
+            joined      = true;
+        }
+    }
+
+    void scan(const std::vector<std::string> &args) {
+        const uint32_t mode     = strtoul(args[1].c_str(), nullptr, 16);
+        const uint32_t mask     = strtoul(args[2].c_str(), nullptr, 16);
+        const uint32_t duration = strtoul(args[3].c_str(), nullptr, 16);
+        uint32_t channels       = 0;
+        for (uint32_t m = mask; m != 0; m >>= 1) {
+            channels += m & 1;
+        }
+        const uint32_t scanTime = config.scanTimeMs * channels * (duration + 1) / 8;
+        emit(config.commandLatencyMs, "OK");
+        if (mode == 0) {
+            std::string energy;
+            char s[8];
+            for (uint32_t i = 0; i < 28; i++) {
+                if (mask & (1UL << i)) {
+                    snprintf(s, sizeof(s), "%s%02X %02X", energy.empty() ? "" : " ", (unsigned)(33 + i), (unsigned)(33 + i == config.channel ? 0x60 : 0x10 + (i * 7) % 0x30));
+                    energy += s;
+                }
+            }
+            emit(scanTime, "EVENT 1F " + moduleIpv6());
+            emit(scanTime, "EEDSCAN");
+            emit(scanTime, energy);
+            return;
+        }
+        if (mask & (1UL << (config.channel - 33))) {
+            char s[32];
+            emit(scanTime / 2, "EVENT 20 " + meterIpv6());
+            emit(scanTime / 2, "EPANDESC");
+            snprintf(s, sizeof(s), "  Channel:%02X", config.channel);
+            emit(scanTime / 2, s);
+            emit(scanTime / 2, "  Channel Page:09");
+            snprintf(s, sizeof(s), "  Pan ID:%04X", config.panId);
+            emit(scanTime / 2, s);
+            emit(scanTime / 2, "  Addr:" + config.meterMac);
+            snprintf(s, sizeof(s), "  LQI:%02X", config.lqi);
+            emit(scanTime / 2, s);
+            emit(scanTime / 2, "  PairID:00112233");
+        }
+        emit(scanTime, "EVENT 22 " + moduleIpv6());
+    }
+
+    void sendTo(const std::vector<uint8_t> &data) {
+        const uint32_t airtime = AirtimeBudget::estimateAirtimeMs(data.size());
+        if (config.airtimeLimitMs > 0 && cumulativeSendingTime + airtime > config.airtimeLimitMs) {
+            emit(config.commandLatencyMs, "EVENT 32 " + moduleIpv6());
+            emit(config.commandLatencyMs, "OK");
+            return;
+        }
+        cumulativeSendingTime += airtime;
+        const uint32_t sendTime = config.sendTimeMs + jitter();
+        if (!joined || chance(config.sendFailureRate)) {
+            stats.failedSends++;
+            emit(sendTime, "EVENT 21 " + meterIpv6() + " 01");
+            emit(sendTime, "OK");
+            return;
+        }
+        emit(sendTime, "EVENT 21 " + meterIpv6() + " 00");
+        emit(sendTime, "OK");
+        // EHD1 EHD2 TID(2) SEOJ(3) DEOJ(3) ESV OPC (EPC PDC EDT)...
+        if (data.size() < 12 || data[0] != 0x10 || data[1] != 0x81 || data[10] != 0x62) {
+            return;
+        }
+        stats.requests++;
+        if (chance(config.responseLossRate)) {
+            stats.lostResponses++;
+            return;
+        }
+        std::vector<uint8_t> epcs;
+        for (size_t i = 12; i + 1 < data.size() && epcs.size() < data[11]; i += 2 + data[i + 1]) {
+            epcs.push_back(data[i]);
+        }
+        std::vector<bool> missing(epcs.size(), false);
+        bool partial = false;
+        for (size_t i = 0; i < epcs.size(); i++) {
+            missing[i] = properties.count(epcs[i]) == 0;
+            partial |= missing[i];
+        }
+        if (!partial && chance(config.partialResponseRate)) {
+            const size_t drop = std::uniform_int_distribution<size_t>(0, epcs.size() - 1)(rng);
+            missing[drop]     = true;
+            partial           = true;
+        }
+        std::vector<uint8_t> frame = {0x10, 0x81, data[2], data[3], 0x02, 0x88, 0x01, data[4], data[5], data[6], static_cast<uint8_t>(partial ? 0x52 : 0x72), static_cast<uint8_t>(epcs.size())};
+        for (size_t i = 0; i < epcs.size(); i++) {
+            frame.push_back(epcs[i]);
+            if (missing[i]) {
+                frame.push_back(0);
+            } else {
+                const std::vector<uint8_t> &edt = properties[epcs[i]];
+                frame.push_back(static_cast<uint8_t>(edt.size()));
+                frame.insert(frame.end(), edt.begin(), edt.end());
+            }
+        }
+        stats.responses++;
+        stats.partialResponses += partial ? 1 : 0;
+        emit(sendTime + config.responseLatencyMs + jitter(), erxudp(frame));
+    }
+
+    void sendInf() {
+        const std::vector<uint8_t> &edt = properties[0xEA];
+        std::vector<uint8_t> frame      = {0x10, 0x81, 0x00, 0x00, 0x02, 0x88, 0x01, 0x05, 0xFF, 0x01, 0x73, 0x01, 0xEA, static_cast<uint8_t>(edt.size())};
+        frame.insert(frame.end(), edt.begin(), edt.end());
+        stats.infNotifications++;
+        emit(0, erxudp(frame));
+    }
+
+    std::string erxudp(const std::vector<uint8_t> &frame) const {
+        char header[160];
+        snprintf(header, sizeof(header), "ERXUDP %s %s 0E1A 0E1A %s 1 %04X ", meterIpv6().c_str(), moduleIpv6().c_str(), config.meterMac.c_str(), (unsigned)frame.size());
+        std::string line = header;
+        char hex[3];
+        for (const uint8_t b : frame) {
+            snprintf(hex, sizeof(hex), "%02X", b);
+            line += hex;
+        }
+        return line;
+    }
+
+    std::string readRegister(const std::string &reg) const {
+        char s[12];
+        if (reg == "S2") {
+            snprintf(s, sizeof(s), "%02X", registerChannel);
+        } else if (reg == "S3") {
+            snprintf(s, sizeof(s), "%04X", registerPanId);
+        } else if (reg == "SFD") {
+            snprintf(s, sizeof(s), "%08X", (unsigned)cumulativeSendingTime);
+        } else if (reg == "SFE") {
+            snprintf(s, sizeof(s), "%X", echo ? 1 : 0);
+        } else {
+            snprintf(s, sizeof(s), "00");
+        }
+        return std::string(s);
+    }
+
+    void writeRegister(const std::string &reg, const std::string &value) {
+        if (reg == "S2") {
+            registerChannel = static_cast<uint8_t>(strtoul(value.c_str(), nullptr, 16));
+        } else if (reg == "S3") {
+            registerPanId = static_cast<uint16_t>(strtoul(value.c_str(), nullptr, 16));
+        } else if (reg == "SFE") {
+            echo = strtoul(value.c_str(), nullptr, 16) != 0;
+        }
+    }
+
+    void reset() {
+        echo            = true;
+        joined          = false;
+        registerChannel = 0x21;
+        registerPanId   = 0xFFFF;
+        outputs.clear();
+    }
+
+    static std::vector<std::string> split(const std::string &line) {
+        std::vector<std::string> tokens;
+        size_t start = 0;
+        while (start < line.size()) {
+            const size_t end = line.find(' ', start);
+            if (end != start) {
+                tokens.push_back(line.substr(start, end == std::string::npos ? std::string::npos : end - start));
+            }
+            if (end == std::string::npos) {
+                break;
+            }
+            start = end + 1;
+        }
+        if (tokens.empty()) {
+            tokens.push_back("");
+        }
+        return tokens;
+    }
+
+    Config config;
+    Stats stats;
+    std::mt19937 rng;
+    std::function<uint32_t()> clock;
+    std::map<uint8_t, std::vector<uint8_t>> properties;
+    std::string tx;
+    std::deque<char> rx;
+    std::deque<Output> outputs;
+    bool echo                      = true;
+    bool hexOutput                 = false;
+    bool joined                    = false;
+    bool joinPending               = false;
+    bool sleeping                  = false;
+    bool waking                    = false;
+    uint8_t registerChannel        = 0x21;
+    uint16_t registerPanId         = 0xFFFF;
+    uint32_t cumulativeSendingTime = 0;
+    uint32_t nextInf               = 0;
+    uint32_t startedAt             = 0;
+    uint32_t sleepStartedAt        = 0;
+    uint32_t awakeAt               = 0;
+    uint32_t hostBaudRate;
+    uint32_t moduleBaudRate;
+    uint32_t persistedBaudRate;
+};
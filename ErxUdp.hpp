@@ -1,5 +1,6 @@
 #pragma once
 
+#include "HexCodec.hpp"
 #include <cstring>
 #include <stdint.h>
 #include <string>
@@ -30,11 +31,11 @@ class ErxUdp {
   public:
     std::string senderIpv6;
     std::string destIpv6;
-    uint16_t senderPort;
-    uint16_t destPort;
+    uint16_t senderPort = 0;
+    uint16_t destPort   = 0;
     std::string senderMac;
-    bool secured;
-    uint16_t length;
+    bool secured    = false;
+    uint16_t length = 0;
     std::string payload;
     ErxUdp() {};
     ErxUdp(const std::string &erxUdpData) {
@@ -50,4 +51,61 @@ class ErxUdp {
             this->payload    = result[8];
         }
     };
+
+    /// @brief ERXUDP行を解析する
+    /// @details 行を分割せずに各項目をその場で読み、文字列は既存の領域に上書きする。
+    ///          同じインスタンスを使い回せば、2回目以降はヒープを確保しない
+    /// @return 項目数が9でない場合はfalse(各項目は空になる)
+    bool parse(const std::string &erxUdpData) {
+        constexpr size_t fieldCount = 9;
+        const char *field[fieldCount];
+        size_t fieldLength[fieldCount];
+        size_t count          = 0;
+        const char *p         = erxUdpData.c_str();
+        const char *const end = p + erxUdpData.length();
+        while (p < end) {
+            if (*p == ' ') {
+                p++;
+                continue;
+            }
+            const char *next = static_cast<const char *>(memchr(p, ' ', end - p));
+            if (next == nullptr) {
+                next = end;
+            }
+            if (count < fieldCount) {
+                field[count]       = p;
+                fieldLength[count] = next - p;
+            }
+            count++;
+            p = next;
+        }
+        if (count != fieldCount) {
+            this->senderIpv6.clear();
+            this->destIpv6.clear();
+            this->senderMac.clear();
+            this->payload.clear();
+            this->senderPort = this->destPort = this->length = 0;
+            this->secured                                    = false;
+            return false;
+        }
+        this->senderIpv6.assign(field[1], fieldLength[1]);
+        this->destIpv6.assign(field[2], fieldLength[2]);
+        this->senderPort = strtol(field[3], NULL, 16);
+        this->destPort   = strtol(field[4], NULL, 16);
+        this->senderMac.assign(field[5], fieldLength[5]);
+        this->secured = strtol(field[6], NULL, 16);
+        this->length  = strtol(field[7], NULL, 16);
+        this->payload.assign(field[8], fieldLength[8]);
+        return true;
+    }
+
+    /// @brief データ部(16進ASCII)をバイナリに変換する
+    /// @return データ長がlengthと一致しない、または16進以外の文字を含む場合はfalse
+    bool decodePayload(std::vector<uint8_t> &data) const {
+        if (this->payload.length() != static_cast<size_t>(this->length) * 2) {
+            return false;
+        }
+        data.resize(this->length);
+        return HexCodec::decode(this->payload.data(), this->payload.length(), data.data());
+    }
 };
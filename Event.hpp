@@ -74,7 +74,7 @@ class Event {
             this->type = (Type)(unsigned int)strtoul(&eventChar[5], NULL, 16);
             memcpy(&sender, &eventChar[9], 39);
             if (size >= 51) {
-                this->parameter = (Parameter)(unsigned int)strtoul(&eventChar[50], NULL, 16);
+                this->parameter = (Parameter)(unsigned int)strtoul(&eventChar[48], NULL, 16);
             }
         }
     }
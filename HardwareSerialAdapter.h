@@ -1,10 +1,13 @@
 #pragma once
 #include "ISerialIO.h"
 #include <HardwareSerial.h>
+#include <algorithm>
+#include <cstring>
 
 class HardwareSerialAdapter : public ISerialIO {
   public:
-    HardwareSerialAdapter(HardwareSerial &serial) : serial_(serial) {}
+    /// @param baudRate serialをbegin() した速度。ESP32以外ではUART速度を取得できないため、指定しなければ速度の変更は行わない
+    HardwareSerialAdapter(HardwareSerial &serial, uint32_t baudRate = 0) : serial_(serial), baudRate_(baudRate) {}
     virtual ~HardwareSerialAdapter() = default;
     virtual size_t write(uint8_t data) {
         return serial_.write(data);
@@ -13,10 +16,16 @@ class HardwareSerialAdapter : public ISerialIO {
         return serial_.write(buffer, size);
     }
     virtual int read() {
+        if (!pending_.empty()) {
+            const uint8_t data = static_cast<uint8_t>(pending_.front());
+            pending_.erase(0, 1);
+            return data;
+        }
         return serial_.read();
     }
+    /// @details read() と同じく、持ち越した受信データも数える
     virtual int available() {
-        return serial_.available();
+        return serial_.available() + static_cast<int>(pending_.size());
     }
     virtual void flush() {
         serial_.flush();
@@ -31,10 +40,71 @@ class HardwareSerialAdapter : public ISerialIO {
         String arduinoStr = serial_.readStringUntil(terminator);
         return std::string(arduinoStr.c_str());
     }
+    /// @details 受信済みの分だけ読み、終端が来ていない行は次回へ持ち越す(readStringUntil() と違い待たない)。
+    ///          終端が来ないままmaxLineLengthを超えた行は、次の終端までを読み飛ばす
+    virtual bool readLine(std::string &line, char terminator) {
+        while (serial_.available() > 0) {
+            const int data = serial_.read();
+            if (data < 0) {
+                break;
+            }
+            if (data == terminator) {
+                if (discarding_) {
+                    discarding_ = false;
+                    continue;
+                }
+                line.assign(pending_);
+                pending_.clear();
+                return !line.empty();
+            }
+            if (discarding_) {
+                continue;
+            }
+            if (pending_.size() >= maxLineLength) {
+                ++overflows_;
+                discarding_ = true;
+                pending_.clear();
+                continue;
+            }
+            pending_.push_back(static_cast<char>(data));
+        }
+        line.clear();
+        return false;
+    }
     virtual size_t readBytes(uint8_t *buffer, size_t length) {
-        return serial_.readBytes(buffer, length);
+        const size_t carried = std::min(length, pending_.size());
+        memcpy(buffer, pending_.data(), carried);
+        pending_.erase(0, carried);
+        return carried + serial_.readBytes(&buffer[carried], length - carried);
+    }
+    virtual bool setBaudRate(uint32_t baudRate) {
+        serial_.flush();
+#if defined(ARDUINO_ARCH_ESP32)
+        serial_.updateBaudRate(baudRate);
+#else
+        serial_.end();
+        serial_.begin(baudRate);
+#endif
+        baudRate_ = baudRate;
+        pending_.clear();
+        discarding_ = false;
+        return true;
+    }
+    virtual uint32_t getBaudRate() const {
+#if defined(ARDUINO_ARCH_ESP32)
+        return serial_.baudRate();
+#else
+        return baudRate_;
+#endif
+    }
+    virtual uint32_t getLineOverflows() const {
+        return overflows_;
     }
 
   private:
     HardwareSerial &serial_;
+    uint32_t baudRate_;          // ESP32以外での現在のUART速度。不明な場合は0
+    std::string pending_;        // 終端がまだ来ていない受信データ
+    bool discarding_    = false; // 上限を超えた行の残りを次の終端まで捨てている
+    uint32_t overflows_ = 0;     // 上限を超えて捨てた行の数
 };
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief 16進ASCII文字列のデコード
+/// @details 8文字ずつ64bit整数に読み込み、SWAR(SIMD within a register)で検証と変換を同時に行う。
+///          端数はバイト毎に処理する。リトルエンディアン以外の環境では常にバイト毎に処理する。
+namespace HexCodec {
+
+inline int8_t nibble(const char c) {
+    if (c >= '0' && c <= '9') {
+        return static_cast<int8_t>(c - '0');
+    }
+    if (c >= 'A' && c <= 'F') {
+        return static_cast<int8_t>(c - 'A' + 10);
+    }
+    if (c >= 'a' && c <= 'f') {
+        return static_cast<int8_t>(c - 'a' + 10);
+    }
+    return -1;
+}
+
+/// @brief 8文字の16進ASCIIを4バイトに変換する
+/// @return 16進以外の文字を含む場合はfalse
+inline bool decode8(const char *const src, uint8_t *const dst) {
+    constexpr uint64_t ones = 0x0101010101010101ULL;
+    constexpr uint64_t high = 0x8080808080808080ULL;
+    uint64_t v;
+    memcpy(&v, src, sizeof(v));
+    if (v & high) {
+        return false;
+    }
+    // 各バイトが[lo, hi]に入っていれば最上位ビットが立つ(全バイト0x80未満なので桁上がりしない)
+    const uint64_t lower  = v | (0x20 * ones);
+    const uint64_t digit  = ((v + (0x80 - '0') * ones) & ~(v + (0x7F - '9') * ones)) & high;
+    const uint64_t letter = ((lower + (0x80 - 'a') * ones) & ~(lower + (0x7F - 'f') * ones)) & high;
+    if ((digit | letter) != high) {
+        return false;
+    }
+    const uint64_t value = (v & (0x0F * ones)) + (letter >> 7) * 9;
+    uint64_t packed      = ((value << 4) | (value >> 8)) & 0x00FF00FF00FF00FFULL;
+    packed               = (packed | (packed >> 8)) & 0x0000FFFF0000FFFFULL;
+    packed               = (packed | (packed >> 16)) & 0x00000000FFFFFFFFULL;
+    const uint32_t bytes = static_cast<uint32_t>(packed);
+    memcpy(dst, &bytes, sizeof(bytes));
+    return true;
+}
+
+/// @brief 16進ASCII文字列をバイト列に変換する
+/// @param length 文字数(偶数)
+/// @param dst length / 2 バイト以上の領域
+/// @return 奇数長または16進以外の文字を含む場合はfalse
+inline bool decode(const char *const src, const size_t length, uint8_t *const dst) {
+    if (length % 2 != 0) {
+        return false;
+    }
+    size_t i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= length; i += 8) {
+        if (!decode8(&src[i], &dst[i / 2])) {
+            return false;
+        }
+    }
+#endif
+    for (; i < length; i += 2) {
+        const int8_t h = nibble(src[i]);
+        const int8_t l = nibble(src[i + 1]);
+        if (h < 0 || l < 0) {
+            return false;
+        }
+        dst[i / 2] = static_cast<uint8_t>((h << 4) | l);
+    }
+    return true;
+}
+
+} // namespace HexCodec
@@ -5,6 +5,9 @@
 
 class ISerialIO {
 public:
+    /// @brief readLine() で持ち越す1行の上限[byte](ERXUDPのデータ部最大1232バイトを16進で含む行が収まる長さ)
+    static constexpr size_t maxLineLength = 2600;
+
     virtual ~ISerialIO() = default;
     virtual size_t write(uint8_t data) = 0;
     virtual size_t write(const uint8_t *buffer, size_t size) = 0;
@@ -15,4 +18,16 @@ public:
     virtual size_t println(const std::string &data) = 0;
     virtual std::string readStringUntil(char terminator) = 0;
     virtual size_t readBytes(uint8_t *buffer, size_t length) = 0;
+    /// @brief 終端までの1行をlineに上書きする。lineの領域を使い回せる実装はヒープを確保しない
+    /// @return 1文字以上読めた場合はtrue
+    virtual bool readLine(std::string &line, char terminator) {
+        line = readStringUntil(terminator);
+        return !line.empty();
+    }
+    /// @return 終端が来ないままmaxLineLengthを超えて捨てた行の数
+    virtual uint32_t getLineOverflows() const { return 0; }
+    /// @brief ホスト側のUART速度を変更する。変更できない場合はfalse
+    virtual bool setBaudRate(uint32_t /*baudRate*/) { return false; }
+    /// @return 現在のUART速度。不明な場合は0
+    virtual uint32_t getBaudRate() const { return 0; }
 };
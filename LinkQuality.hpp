@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief リンク品質の統計(移動平均)
+/// @details LQIはEPANDESC/EDスキャン結果から、送信成功率と応答時間はUDP送受信から積算する。
+///          平均は指数移動平均(係数alpha)で、サンプル数が少ないうちは単純平均として扱う。
+class LinkQuality {
+  public:
+    static constexpr uint8_t firstChannel = 33; // SKSCANのチャンネルマスク bit0
+    static constexpr size_t channelCount  = 28; // 33ch - 60ch
+
+    /// @brief BP35A1のLQIを受信電力[dBm]に換算する
+    static float lqiToRssi(const uint8_t lqi) {
+        return 0.275f * lqi - 104.27f;
+    }
+
+    struct Average {
+        float value    = 0;
+        float min      = 0;
+        float max      = 0;
+        uint32_t count = 0;
+
+        void add(const float sample, const float alpha) {
+            const float a = count < static_cast<uint32_t>(1.0f / alpha) ? 1.0f / (count + 1) : alpha;
+            value += a * (sample - value);
+            min = (count == 0 || sample < min) ? sample : min;
+            max = (count == 0 || sample > max) ? sample : max;
+            count++;
+        }
+    };
+
+    void setAlpha(const float alpha) {
+        this->alpha = alpha > 0 && alpha <= 1 ? alpha : this->alpha;
+    }
+
+    /// @param minLqi LQI平均がこれを下回ったら劣化と判定
+    /// @param minSendSuccessRatio 送信成功率がこれを下回ったら劣化と判定
+    void setDegradedThreshold(const uint8_t minLqi, const float minSendSuccessRatio) {
+        this->minLqi              = minLqi;
+        this->minSendSuccessRatio = minSendSuccessRatio;
+    }
+
+    void addLqi(const uint8_t lqi) {
+        lqiAverage.add(lqi, alpha);
+        rssiAverage.add(lqiToRssi(lqi), alpha);
+    }
+
+    void addSendResult(const bool success) {
+        sendSuccess.add(success ? 1.0f : 0.0f, alpha);
+    }
+
+    void addResponseLatency(const uint32_t ms) {
+        responseLatency.add(static_cast<float>(ms), alpha);
+    }
+
+    /// @brief EDスキャンを開始する。結果はcompleteEdScan() まで反映しない
+    void beginEdScan() {
+        edScanInProgress = true;
+        pendingScanned   = 0;
+    }
+
+    /// @brief EDスキャン結果(チャンネル毎の受信エネルギー)を記録する
+    void addChannelEnergy(const uint8_t channel, const uint8_t lqi) {
+        if (channel < firstChannel || channel >= firstChannel + channelCount) {
+            return;
+        }
+        pendingEnergy[channel - firstChannel] = lqi;
+        pendingScanned |= 1UL << (channel - firstChannel);
+    }
+
+    void completeEdScan() {
+        for (size_t i = 0; i < channelCount; i++) {
+            if (pendingScanned & (1UL << i)) {
+                channelEnergy[i] = pendingEnergy[i];
+            }
+        }
+        channelScanned |= pendingScanned;
+        edScanInProgress = false;
+        edScanCount++;
+    }
+
+    /// @brief 結果が揃わなかったEDスキャンを捨てる(タイムアウトや不正な結果行)
+    void abandonEdScan() {
+        edScanInProgress = false;
+        pendingScanned   = 0;
+        edScanAbandoned++;
+    }
+
+    bool isEdScanInProgress() const {
+        return edScanInProgress;
+    }
+
+    bool isDegraded() const {
+        if (lqiAverage.count > 0 && lqiAverage.value < minLqi) {
+            return true;
+        }
+        return sendSuccess.count >= minSendSamples && sendSuccess.value < minSendSuccessRatio;
+    }
+
+    /// @brief EDスキャンで受信エネルギーがthreshold以下だったチャンネルのSKSCAN用マスク
+    /// @param currentChannel 現在のチャンネル(常に含める)
+    uint32_t quietChannelMask(const uint8_t currentChannel, const uint8_t threshold) const {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < channelCount; i++) {
+            if ((channelScanned & (1UL << i)) && channelEnergy[i] <= threshold) {
+                mask |= 1UL << i;
+            }
+        }
+        if (currentChannel >= firstChannel && currentChannel < firstChannel + channelCount) {
+            mask |= 1UL << (currentChannel - firstChannel);
+        }
+        return mask;
+    }
+
+    uint8_t getChannelEnergy(const uint8_t channel) const {
+        if (channel < firstChannel || channel >= firstChannel + channelCount) {
+            return 0;
+        }
+        return channelEnergy[channel - firstChannel];
+    }
+
+    /// @brief 送信成功率などの統計をリセットする(再接続時)
+    void resetLinkStatistics() {
+        lqiAverage      = Average();
+        rssiAverage     = Average();
+        sendSuccess     = Average();
+        responseLatency = Average();
+    }
+
+    const Average &getLqi() const {
+        return lqiAverage;
+    }
+    const Average &getRssi() const {
+        return rssiAverage;
+    }
+    const Average &getSendSuccessRatio() const {
+        return sendSuccess;
+    }
+    const Average &getResponseLatency() const {
+        return responseLatency;
+    }
+    uint32_t getEdScanCount() const {
+        return edScanCount;
+    }
+    uint32_t getEdScanAbandonedCount() const {
+        return edScanAbandoned;
+    }
+
+  private:
+    static constexpr uint32_t minSendSamples = 4;
+
+    float alpha               = 0.2f;
+    uint8_t minLqi            = 0x40;
+    float minSendSuccessRatio = 0.5f;
+    Average lqiAverage;
+    Average rssiAverage;
+    Average sendSuccess;
+    Average responseLatency;
+    uint8_t channelEnergy[channelCount] = {0};
+    uint32_t channelScanned             = 0;
+    uint8_t pendingEnergy[channelCount] = {0}; // 実行中のEDスキャンの結果
+    uint32_t pendingScanned             = 0;
+    bool edScanInProgress               = false;
+    uint32_t edScanCount                = 0;
+    uint32_t edScanAbandoned            = 0;
+};
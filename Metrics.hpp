@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdio>
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief 監視用のカウンタとゲージ
+/// @details 出力はPrometheusのテキスト形式と固定レイアウトのバイナリ形式。
+///          どちらも呼び出し側のバッファに書き込み、メモリ確保は行わない。
+class Metrics {
+  public:
+    enum class Counter : uint8_t {
+        PanaFailures,
+        Scans,
+        ScanRetries,
+        UdpSends,
+        UdpSendRetries,
+        UdpSendFailures,
+        UnexpectedLines,
+        Reinitializations,
+        DeepSleeps,
+        PartialResponses,
+        RecoveryRetries,
+        RecoveryRejoins,
+        RecoveryRescans,
+        RecoveryResets,
+        CommandBusyRetries,
+        CommandRejections,
+        DerivedValueMismatches,
+        Count,
+    };
+
+    enum class Gauge : uint8_t {
+        Lqi,
+        InitializeState,
+        CommunicationState,
+        TimeInInitializeStateMs,
+        TimeInCommunicationStateMs,
+        AirtimeRemainingMs,
+        WakeLatencyMs,
+        Count,
+    };
+
+    static constexpr size_t counterCount = static_cast<size_t>(Counter::Count);
+    static constexpr size_t gaugeCount   = static_cast<size_t>(Gauge::Count);
+
+    /// @brief バイナリ形式の大きさ
+    /// @details "BM" / バージョン / カウンタ数 / ゲージ数 の後にカウンタ(uint32)、ゲージ(int32)をリトルエンディアンで並べる
+    static constexpr size_t binarySize = 5 + 4 * (counterCount + gaugeCount);
+    static constexpr uint8_t binaryVersion = 1;
+
+    void increment(const Counter counter, const uint32_t n = 1) {
+        counters[static_cast<size_t>(counter)] += n;
+    }
+
+    void set(const Gauge gauge, const int32_t value) {
+        gauges[static_cast<size_t>(gauge)] = value;
+    }
+
+    uint32_t get(const Counter counter) const {
+        return counters[static_cast<size_t>(counter)];
+    }
+
+    int32_t get(const Gauge gauge) const {
+        return gauges[static_cast<size_t>(gauge)];
+    }
+
+    /// @return 書き込んだバイト数(終端のNULは含まない)。バッファが足りない場合は0
+    size_t renderPrometheus(char *const buffer, const size_t size, const char *const prefix = "bp35a1") const {
+        size_t pos = 0;
+        for (size_t i = 0; i < counterCount; i++) {
+            if (!append(buffer, size, &pos, "# TYPE %s_%s_total counter\n%s_%s_total %lu\n", prefix, counterNames[i], prefix, counterNames[i], (unsigned long)counters[i])) {
+                return 0;
+            }
+        }
+        for (size_t i = 0; i < gaugeCount; i++) {
+            if (!append(buffer, size, &pos, "# TYPE %s_%s gauge\n%s_%s %ld\n", prefix, gaugeNames[i], prefix, gaugeNames[i], (long)gauges[i])) {
+                return 0;
+            }
+        }
+        return pos;
+    }
+
+    /// @return 書き込んだバイト数。バッファが足りない場合は0
+    size_t renderBinary(uint8_t *const buffer, const size_t size) const {
+        if (size < binarySize) {
+            return 0;
+        }
+        buffer[0] = 'B';
+        buffer[1] = 'M';
+        buffer[2] = binaryVersion;
+        buffer[3] = static_cast<uint8_t>(counterCount);
+        buffer[4] = static_cast<uint8_t>(gaugeCount);
+        size_t pos = 5;
+        for (size_t i = 0; i < counterCount; i++) {
+            pos = putU32(buffer, pos, counters[i]);
+        }
+        for (size_t i = 0; i < gaugeCount; i++) {
+            pos = putU32(buffer, pos, static_cast<uint32_t>(gauges[i]));
+        }
+        return pos;
+    }
+
+  private:
+    static constexpr const char *counterNames[counterCount] = {
+        "pana_failures",
+        "scans",
+        "scan_retries",
+        "udp_sends",
+        "udp_send_retries",
+        "udp_send_failures",
+        "unexpected_lines",
+        "reinitializations",
+        "deep_sleeps",
+        "partial_responses",
+        "recovery_retries",
+        "recovery_rejoins",
+        "recovery_rescans",
+        "recovery_resets",
+        "command_busy_retries",
+        "command_rejections",
+        "derived_value_mismatches",
+    };
+
+    static constexpr const char *gaugeNames[gaugeCount] = {
+        "lqi",
+        "initialize_state",
+        "communication_state",
+        "time_in_initialize_state_ms",
+        "time_in_communication_state_ms",
+        "airtime_remaining_ms",
+        "wake_latency_ms",
+    };
+
+    template <class... Args>
+    static bool append(char *const buffer, const size_t size, size_t *const pos, const char *const format, Args... args) {
+        const int n = snprintf(&buffer[*pos], size - *pos, format, args...);
+        if (n < 0 || static_cast<size_t>(n) >= size - *pos) {
+            return false;
+        }
+        *pos += static_cast<size_t>(n);
+        return true;
+    }
+
+    static size_t putU32(uint8_t *const buffer, size_t pos, const uint32_t value) {
+        buffer[pos++] = static_cast<uint8_t>(value);
+        buffer[pos++] = static_cast<uint8_t>(value >> 8);
+        buffer[pos++] = static_cast<uint8_t>(value >> 16);
+        buffer[pos++] = static_cast<uint8_t>(value >> 24);
+        return pos;
+    }
+
+    uint32_t counters[counterCount] = {0};
+    int32_t gauges[gaugeCount]      = {0};
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief 固定長の複数生産者・単一消費者キュー(ロックフリー)
+/// @details D. Vyukov の bounded MPMC queue を消費者1つに限定したもの。各セルの sequence で
+///          書き込み済みかを判定するため、生産者同士は enqueuePos の CAS のみで競合し、
+///          満杯のときは待たずに false を返す。push() は任意のタスクから、pop() は1つのタスクからのみ呼ぶ。
+template <class T, size_t Capacity>
+class MpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+  public:
+    MpscQueue() {
+        for (size_t i = 0; i < Capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue &)            = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    /// @return 満杯の場合はfalse
+    bool push(const T &value) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell                = &cells[pos & mask];
+            const size_t seq    = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @return 空の場合はfalse
+    bool pop(T &value) {
+        const size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Cell &cell       = cells[pos & mask];
+        if (static_cast<intptr_t>(cell.sequence.load(std::memory_order_acquire)) - static_cast<intptr_t>(pos + 1) < 0) {
+            return false;
+        }
+        value = cell.value;
+        cell.sequence.store(pos + Capacity, std::memory_order_release);
+        dequeuePos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+  private:
+    static constexpr size_t mask = Capacity - 1;
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell cells[Capacity];
+    alignas(32) std::atomic<size_t> enqueuePos{0};
+    alignas(32) std::atomic<size_t> dequeuePos{0};
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/// @brief プロパティの定期取得スケジューラ
+/// @details EPCの組を周期と優先度で登録する。周期の開始時刻(リリース)を過ぎたものを対象に、
+///          優先度の高いクラスから締め切り(リリース + 周期)の早い順(EDF)に選ぶ。
+///          同時に期限が来ているもの・mergeWindowMs以内にリリースされるものは1つのGetにまとめる。
+///          時刻はすべて呼び出し側から受け取る[ms]。
+class PollScheduler {
+  public:
+    enum class Priority : uint8_t {
+        High,
+        Normal,
+        Low,
+    };
+
+    using Handle = int;
+
+    struct Stats {
+        uint32_t issued          = 0; // 送信したGetの数
+        uint32_t merged          = 0; // 他の登録に相乗りした回数
+        uint32_t completed       = 0; // 応答を受け取った登録の数
+        uint32_t failed          = 0; // 応答のなかった登録の数
+        uint32_t missedDeadlines = 0; // 締め切りまでに応答を受け取れなかった、または周期を飛ばした回数
+        uint32_t maxJitterMs     = 0; // リリースから送信までの遅れの最大値
+        float meanJitterMs       = 0;
+    };
+
+    /// @param mergeWindowMs この時間以内にリリースされる登録も前倒しでまとめる
+    /// @param maxProperties 1つのGetにまとめるEPCの最大数
+    void setMerge(const uint32_t mergeWindowMs, const size_t maxProperties) {
+        this->mergeWindowMs = mergeWindowMs;
+        this->maxProperties = maxProperties > 0 ? maxProperties : 1;
+    }
+
+    /// @param firstDelayMs 初回のリリースまでの時間
+    /// @return remove() に渡すハンドル
+    Handle add(const std::vector<uint8_t> &epcs, const uint32_t periodMs, const Priority priority, const uint32_t now, const uint32_t firstDelayMs = 0) {
+        entries.push_back({nextHandle, epcs, periodMs > 0 ? periodMs : 1, priority, now + firstDelayMs, false, false});
+        return nextHandle++;
+    }
+
+    void remove(const Handle handle) {
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [handle](const Entry &e) { return e.handle == handle; }), entries.end());
+    }
+
+    void clear() {
+        entries.clear();
+        inFlight = false;
+    }
+
+    bool empty() const {
+        return entries.empty();
+    }
+
+    bool isInFlight() const {
+        return inFlight;
+    }
+
+    /// @brief 送信すべき登録を選び、まとめたEPCをepcsに入れる(まだ送信済みにはしない)
+    /// @return 期限の来た登録がない、または応答待ちの場合はfalse
+    bool collect(const uint32_t now, std::vector<uint8_t> &epcs) {
+        epcs.clear();
+        if (inFlight) {
+            return false;
+        }
+        const Entry *first = nullptr;
+        for (const Entry &e : entries) {
+            if (released(e, now) && (first == nullptr || before(e, *first))) {
+                first = &e;
+            }
+        }
+        if (first == nullptr) {
+            return false;
+        }
+        for (Entry &e : entries) {
+            e.selected = false;
+        }
+        // 先頭を必ず含め、残りは同じ順序で容量の許す限り相乗りさせる
+        candidates.clear();
+        for (Entry &e : entries) {
+            if (&e != first && released(e, now + mergeWindowMs)) {
+                candidates.push_back(&e);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const Entry *a, const Entry *b) { return before(*a, *b); });
+        candidates.insert(candidates.begin(), const_cast<Entry *>(first));
+        for (Entry *e : candidates) {
+            size_t added = 0;
+            for (const uint8_t epc : e->epcs) {
+                added += std::find(epcs.begin(), epcs.end(), epc) == epcs.end() ? 1 : 0;
+            }
+            if (e != first && epcs.size() + added > maxProperties) {
+                continue;
+            }
+            for (const uint8_t epc : e->epcs) {
+                if (std::find(epcs.begin(), epcs.end(), epc) == epcs.end()) {
+                    epcs.push_back(epc);
+                }
+            }
+            e->selected = true;
+        }
+        return true;
+    }
+
+    /// @brief collect() で選んだ登録を送信済みにする
+    void issue(const uint32_t now) {
+        bool any = false;
+        for (Entry &e : entries) {
+            if (!e.selected) {
+                continue;
+            }
+            e.selected = false;
+            e.inFlight = true;
+            const uint32_t jitter = static_cast<int32_t>(now - e.release) > 0 ? now - e.release : 0;
+            stats.maxJitterMs     = std::max(stats.maxJitterMs, jitter);
+            jitterCount++;
+            stats.meanJitterMs += (static_cast<float>(jitter) - stats.meanJitterMs) / jitterCount;
+            stats.merged += any ? 1 : 0;
+            any = true;
+        }
+        if (any) {
+            stats.issued++;
+            inFlight = true;
+        }
+    }
+
+    /// @brief 送信したGetの応答を受け取った(success)、または諦めた
+    void complete(const uint32_t now, const bool success) {
+        for (Entry &e : entries) {
+            if (!e.inFlight) {
+                continue;
+            }
+            e.inFlight = false;
+            if (success) {
+                stats.completed++;
+            } else {
+                stats.failed++;
+            }
+            if (!success || static_cast<int32_t>(now - deadline(e)) > 0) {
+                stats.missedDeadlines++;
+            }
+            e.release += e.periodMs;
+            // 次の締め切りも過ぎている周期は飛ばす
+            while (static_cast<int32_t>(now - deadline(e)) >= 0) {
+                e.release += e.periodMs;
+                stats.missedDeadlines++;
+            }
+        }
+        inFlight = false;
+    }
+
+    /// @return 次のリリースまでの時間。期限の来た登録があれば0、登録がなければUINT32_MAX
+    uint32_t nextReleaseIn(const uint32_t now) const {
+        uint32_t wait = UINT32_MAX;
+        for (const Entry &e : entries) {
+            wait = std::min(wait, released(e, now) ? 0 : e.release - now);
+        }
+        return wait;
+    }
+
+    const Stats &getStats() const {
+        return stats;
+    }
+
+  private:
+    struct Entry {
+        Handle handle;
+        std::vector<uint8_t> epcs;
+        uint32_t periodMs;
+        Priority priority;
+        uint32_t release; // 今周期の開始時刻
+        bool selected;
+        bool inFlight;
+    };
+
+    static bool released(const Entry &e, const uint32_t now) {
+        return static_cast<int32_t>(now - e.release) >= 0;
+    }
+
+    static uint32_t deadline(const Entry &e) {
+        return e.release + e.periodMs;
+    }
+
+    /// @brief 優先度の高い方、同じ優先度なら締め切りの早い方を先にする
+    static bool before(const Entry &a, const Entry &b) {
+        if (a.priority != b.priority) {
+            return a.priority < b.priority;
+        }
+        return static_cast<int32_t>(deadline(a) - deadline(b)) < 0;
+    }
+
+    std::vector<Entry> entries;
+    std::vector<Entry *> candidates; // collect() の作業領域(領域を使い回す)
+    Handle nextHandle      = 0;
+    bool inFlight          = false;
+    uint32_t mergeWindowMs = 500;
+    size_t maxProperties   = 8;
+    uint32_t jitterCount   = 0;
+    Stats stats;
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief 低圧スマート電力量メータのプロパティ(EDT)を型付きの値に変換する
+/// @details EPC毎の型と変換はPropertyTraitsの特殊化で定義し、BP35A1::onProperty() から参照する。
+///          特殊化のないEPCを指定するとコンパイルエラーになる。
+namespace PropertyDecoder {
+
+/// @brief 積算電力量の換算に使う値(初期化時に取得した係数と単位)
+struct Scale {
+    uint32_t coefficient = 1;    // 0xD3 係数
+    float unit           = 1.0f; // 0xE1 積算電力量単位[kWh]
+};
+
+/// @brief 瞬時電流計測値(0xE8)
+struct Current {
+    float r; // R相[A]
+    float t; // T相[A]。単相2線式の場合はNaN
+};
+
+/// @brief 定時積算電力量計測値(0xEA, 0xEB)
+struct TimedEnergy {
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    float kWh;
+};
+
+inline uint16_t u16(const uint8_t *const p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline uint32_t u32(const uint8_t *const p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+/// @brief 積算電力量の計測値をkWhに換算する。0xFFFFFFFE(未計測)はfalse
+inline bool energy(const uint8_t *const edt, const Scale &scale, float *const kWh) {
+    const uint32_t raw = u32(edt);
+    if (raw == 0xFFFFFFFE) {
+        return false;
+    }
+    *kWh = static_cast<float>(raw) * static_cast<float>(scale.coefficient) * scale.unit;
+    return true;
+}
+
+template <uint8_t Epc>
+struct PropertyTraits;
+
+/// @brief 動作状態
+template <>
+struct PropertyTraits<0x80> {
+    using type = bool;
+    static bool decode(const uint8_t *const edt, const uint8_t pdc, const Scale &, type *const value) {
+        if (pdc != 1) {
+            return false;
+        }
+        *value = edt[0] == 0x30;
+        return true;
+    }
+};
+
+/// @brief 係数
+template <>
+struct PropertyTraits<0xD3> {
+    using type = uint32_t;
+    static bool decode(const uint8_t *const edt, const uint8_t pdc, const Scale &, type *const value) {
+        if (pdc != 4) {
+            return false;
+        }
+        *value = u32(edt);
+        return true;
+    }
+};
+
+/// @brief 積算電力量有効桁数
+template <>
+struct PropertyTraits<0xD7> {
+    using type = uint8_t;
+    static bool decode(const uint8_t *const edt, const uint8_t pdc, const Scale &, type *const value) {
+        if (pdc != 1) {
+            return false;
+        }
+        *value = edt[0];
+        return true;
+    }
+};
+
+/// @brief 積算電力量計測値(正方向)[kWh]
+template <>
+struct PropertyTraits<0xE0> {
+    using type = float;
+    static bool decode(const uint8_t *const edt, const uint8_t pdc, const Scale &scale, type *const value) {
+        return pdc == 4 && energy(edt, scale, value);
+    }
+};
+
+/// @brief 積算電力量単位[kWh]
+template <>
+struct PropertyTraits<0xE1> {
+    using type = float;
+    static bool decode(const uint8_t *const edt, const uint8_t pdc, const Scale &, type *const value) {
+        constexpr float small[] = {1.0f, 0.1f, 0.01f, 0.001f, 0.0001f}; // 0x00 - 0x04
+        constexpr float large[] = {10.0f, 100.0f, 1000.0f, 10000.0f};    // 0x0A - 0x0D
+        if (pdc != 1) {
+            return false;
+        }
+        if (edt[0] <= 0x04) {
+            *value = small[edt[0]];
+        } else if (edt[0] >= 0x0A && edt[0] <= 0x0D) {
+            *value = large[edt[0] - 0x0A];
+        } else {
+            return false;
+        }
+        return true;
+    }
+};
+
+/// @brief 積算電力量計測値(逆方向)[kWh]
+template <>
+struct PropertyTraits<0xE3> : PropertyTraits<0xE0> {};
+
+/// @brief 瞬時電力計測値[W]
+template <>
+struct PropertyTraits<0xE7> {
+    using type = int32_t;
+    static bool decode(const uint8_t *const edt, const uint8_t pdc, const Scale &, type *const value) {
+        if (pdc != 4) {
+            return false;
+        }
+        *value = static_cast<int32_t>(u32(edt));
+        return true;
+    }
+};
+
+/// @brief 瞬時電流計測値[A]
+template <>
+struct PropertyTraits<0xE8> {
+    using type = Current;
+    static bool decode(const uint8_t *const edt, const uint8_t pdc, const Scale &, type *const value) {
+        if (pdc != 4) {
+            return false;
+        }
+        const uint16_t t = u16(&edt[2]);
+        value->r         = static_cast<int16_t>(u16(edt)) * 0.1f;
+        value->t         = t == 0x7FFE ? NAN : static_cast<int16_t>(t) * 0.1f;
+        return true;
+    }
+};
+
+/// @brief 定時積算電力量計測値(正方向)
+template <>
+struct PropertyTraits<0xEA> {
+    using type = TimedEnergy;
+    static bool decode(const uint8_t *const edt, const uint8_t pdc, const Scale &scale, type *const value) {
+        if (pdc != 11) {
+            return false;
+        }
+        value->year   = u16(edt);
+        value->month  = edt[2];
+        value->day    = edt[3];
+        value->hour   = edt[4];
+        value->minute = edt[5];
+        value->second = edt[6];
+        return energy(&edt[7], scale, &value->kWh);
+    }
+};
+
+/// @brief 定時積算電力量計測値(逆方向)
+template <>
+struct PropertyTraits<0xEB> : PropertyTraits<0xEA> {};
+
+/// @brief 型付きで受け取れるEPC。onProperty() のハンドラはこの順で並ぶ
+constexpr uint8_t supportedEpcs[] = {0x80, 0xD3, 0xD7, 0xE0, 0xE1, 0xE3, 0xE7, 0xE8, 0xEA, 0xEB};
+constexpr size_t supportedCount   = sizeof(supportedEpcs) / sizeof(supportedEpcs[0]);
+
+/// @brief EPCからハンドラの添字を引く表(対応しないEPCは-1)
+constexpr std::array<int8_t, 256> indexTable = [] {
+    std::array<int8_t, 256> table{};
+    for (size_t i = 0; i < table.size(); i++) {
+        table[i] = -1;
+    }
+    for (size_t i = 0; i < supportedCount; i++) {
+        table[supportedEpcs[i]] = static_cast<int8_t>(i);
+    }
+    return table;
+}();
+
+} // namespace PropertyDecoder
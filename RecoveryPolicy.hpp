@@ -0,0 +1,126 @@
+#pragma once
+
+#include "LinkQuality.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief 初期化失敗時の復旧段階の決定
+/// @details 失敗毎に onFailure() を呼ぶと、段階毎の失敗回数と経過時間に応じて
+///          コマンド再送 → 再JOIN → 再スキャン → モジュールリセット の順に段階を上げる。
+///          初期化が完了したら onSuccess() で段階を戻す。不安定なリンクで復旧と切断を繰り返しても
+///          リセットはresetHoldoffMsに1回までに抑える。
+class RecoveryPolicy {
+  public:
+    enum class Tier : uint8_t {
+        Retry,  // 同じコマンドを再送
+        Rejoin, // チャンネル・PAN IDを設定し直してSKJOIN
+        Rescan, // アクティブスキャンからやり直す
+        Reset,  // SKTERM / SKRESETからやり直す
+        Count,
+    };
+
+    static constexpr size_t tierCount = static_cast<size_t>(Tier::Count);
+
+    /// @brief onFailure() の applicable に渡す段階のビット
+    static constexpr uint8_t bit(const Tier tier) {
+        return static_cast<uint8_t>(1U << static_cast<uint8_t>(tier));
+    }
+    static constexpr uint8_t allTiers = (1U << tierCount) - 1;
+
+    /// @param maxFailures その段階で許す失敗回数。超えたら次の段階へ
+    /// @param timeoutMs その段階に留まれる時間。超えたら次の段階へ
+    void setTier(const Tier tier, const uint8_t maxFailures, const uint32_t timeoutMs) {
+        if (tier < Tier::Reset) {
+            this->maxFailures[static_cast<size_t>(tier)] = maxFailures;
+            this->timeoutMs[static_cast<size_t>(tier)]   = timeoutMs;
+        }
+    }
+
+    void setResetHoldoff(const uint32_t resetHoldoffMs) {
+        this->resetHoldoffMs = resetHoldoffMs;
+    }
+
+    /// @param minimum 今回の失敗に効果のない段階を飛ばす(引数の誤りで再送しても無駄な場合など)
+    /// @param applicable 今回の失敗に行える段階(bit() の論理和)。含まれない段階は次の段階に上げる。
+    ///                   RetryとResetは常に行えるものとする
+    /// @return 今回行う復旧の段階
+    Tier onFailure(const uint32_t now, const Tier minimum = Tier::Retry, uint8_t applicable = allTiers) {
+        applicable |= bit(Tier::Retry) | bit(Tier::Reset);
+        if (!recovering) {
+            recovering    = true;
+            firstFailedAt = now;
+            tierEnteredAt = now;
+            tier          = Tier::Retry;
+            failures      = 0;
+        }
+        failures++;
+        while (tier < Tier::Reset && (failures > maxFailures[static_cast<size_t>(tier)] || now - tierEnteredAt >= timeoutMs[static_cast<size_t>(tier)])) {
+            tier          = static_cast<Tier>(static_cast<uint8_t>(tier) + 1);
+            tierEnteredAt = now;
+            failures      = 1;
+        }
+        if (tier < minimum) {
+            tier          = minimum;
+            tierEnteredAt = now;
+            failures      = 1;
+        }
+        while ((applicable & bit(tier)) == 0) {
+            tier          = static_cast<Tier>(static_cast<uint8_t>(tier) + 1);
+            tierEnteredAt = now;
+            failures      = 1;
+        }
+        Tier applied = tier;
+        if (applied == Tier::Reset && resetCount > 0 && now - lastResetAt < resetHoldoffMs) {
+            // 保留中はリセットせず、行える段階のうち最も重いものにとどめる
+            applied = Tier::Rescan;
+            while ((applicable & bit(applied)) == 0) {
+                applied = static_cast<Tier>(static_cast<uint8_t>(applied) - 1);
+            }
+        }
+        if (applied == Tier::Reset) {
+            lastResetAt = now;
+            resetCount++;
+        }
+        counts[static_cast<size_t>(applied)]++;
+        return applied;
+    }
+
+    /// @brief 初期化が完了した
+    void onSuccess(const uint32_t now) {
+        if (recovering) {
+            timeToRecover.add(static_cast<float>(now - firstFailedAt), 0.2f);
+        }
+        recovering = false;
+        tier       = Tier::Retry;
+        failures   = 0;
+    }
+
+    bool isRecovering() const {
+        return recovering;
+    }
+    Tier getTier() const {
+        return tier;
+    }
+    /// @return その段階の復旧を行った回数
+    uint32_t getCount(const Tier tier) const {
+        return tier < Tier::Count ? counts[static_cast<size_t>(tier)] : 0;
+    }
+    /// @brief 最初の失敗から初期化完了までの時間[ms]
+    const LinkQuality::Average &getTimeToRecover() const {
+        return timeToRecover;
+    }
+
+  private:
+    uint8_t maxFailures[tierCount - 1] = {2, 3, 2};
+    uint32_t timeoutMs[tierCount - 1]  = {30000, 120000, 300000};
+    uint32_t resetHoldoffMs            = 600000;
+    bool recovering                    = false;
+    Tier tier                          = Tier::Retry;
+    uint8_t failures                   = 0;
+    uint32_t firstFailedAt             = 0;
+    uint32_t tierEnteredAt             = 0;
+    uint32_t lastResetAt               = 0;
+    uint32_t resetCount                = 0;
+    uint32_t counts[tierCount]         = {0};
+    LinkQuality::Average timeToRecover;
+};
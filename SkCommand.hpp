@@ -0,0 +1,173 @@
+#pragma once
+
+#include "ISerialIO.h"
+#include "SkLine.hpp"
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// @brief SKSTACKコマンドの実行結果
+struct SkCommandResult {
+    enum class Status : uint8_t {
+        Pending,
+        Ok,
+        Fail,
+        Timeout,
+    };
+
+    /// @brief 応答の終わり方
+    enum class Terminator : uint8_t {
+        Ok,         // OK / FAIL ERxx で完了(EINFO, EVER, ESREG などの応答行はlinesに入る)
+        SingleLine, // 1行の応答で完了(SKLL64)
+    };
+
+    Status status     = Status::Pending;
+    uint8_t errorCode = 0; // FAIL ERxx の xx
+    std::vector<std::string> lines;
+
+    bool ready() const {
+        return status != Status::Pending;
+    }
+    bool ok() const {
+        return status == Status::Ok;
+    }
+
+    /// @details ER09: UART入力エラー、ER10: コマンドは受け付けたが実行に失敗した
+    static bool isBusyError(const uint8_t errorCode) {
+        return errorCode == 9 || errorCode == 10;
+    }
+    /// @details ER04: 未対応のコマンド、ER05: 引数の数の誤り、ER06: 引数の形式・値域の誤り
+    static bool isRejectError(const uint8_t errorCode) {
+        return errorCode >= 4 && errorCode <= 6;
+    }
+};
+
+using SkCommandFuture = std::shared_ptr<const SkCommandResult>;
+
+/// @brief SKSTACKコマンドの送信と応答の対応付けを行う
+/// @details 送信したコマンドを順にキューに積み、受信行を先頭のコマンドの応答として割り当てる。
+///          モジュールはコマンドを受信順に処理するため、maxOutstanding 個まで応答を待たずに
+///          続けて送信できる。EVENT / ERXUDP などの非同期行や、EPANDESCの項目・EDスキャン結果のような
+///          コマンドの応答ではない行は消費しない。
+class SkCommandEngine {
+  public:
+    using Callback = std::function<void(const SkCommandResult &)>;
+
+    explicit SkCommandEngine(ISerialIO &serial)
+        : serial_(serial) {}
+
+    void setMaxOutstanding(const size_t maxOutstanding) {
+        this->maxOutstanding = maxOutstanding > 0 ? maxOutstanding : 1;
+    }
+
+    SkCommandFuture submit(const std::string &command, const uint32_t now, Callback done = nullptr, const SkCommandResult::Terminator terminator = SkCommandResult::Terminator::Ok) {
+        auto result = std::make_shared<SkCommandResult>();
+        queue.push_back({command, terminator, std::move(done), result, 0});
+        pump(now);
+        return result;
+    }
+
+    /// @brief 送信待ちのコマンドを送信し、応答のないコマンドをタイムアウトさせる
+    void poll(const uint32_t now) {
+        while (outstanding > 0 && now - queue.front().sentAt >= timeoutMs) {
+            complete(SkCommandResult::Status::Timeout, 0, now);
+        }
+        pump(now);
+    }
+
+    /// @return コマンドの応答として消費した場合はtrue
+    bool onLine(const SkLine &line, const uint32_t now) {
+        if (outstanding == 0 || line.isAsync()) {
+            return false;
+        }
+        for (size_t i = 0; i < outstanding; i++) {
+            if (line.text() == queue[i].command) {
+                return true; // エコーバック
+            }
+        }
+        Pending &head = queue.front();
+        if (line.type == SkLine::Type::Fail) {
+            complete(SkCommandResult::Status::Fail, line.errorCode, now);
+            return true;
+        }
+        if (head.terminator == SkCommandResult::Terminator::Ok && line.type == SkLine::Type::Ok) {
+            if (line.tokenCount > 0) {
+                head.result->lines.push_back(line.text().substr(3));
+            }
+            complete(SkCommandResult::Status::Ok, 0, now);
+            return true;
+        }
+        if (!isResponseLine(line)) {
+            return false;
+        }
+        head.result->lines.push_back(line.text());
+        if (head.terminator == SkCommandResult::Terminator::SingleLine) {
+            complete(SkCommandResult::Status::Ok, 0, now);
+        }
+        return true;
+    }
+
+    bool busy() const {
+        return !queue.empty();
+    }
+
+    /// @brief 送信済み・未送信のコマンドをすべて破棄する(モジュールリセット時)
+    void clear() {
+        queue.clear();
+        outstanding = 0;
+    }
+
+  private:
+    /// @brief コマンドの応答行か(EINFO, EVER, ESREG, EADDRなどの "E" で始まる行とSKLL64の応答)
+    static bool isResponseLine(const SkLine &line) {
+        switch (line.type) {
+            case SkLine::Type::Einfo:
+            case SkLine::Type::Ever:
+            case SkLine::Type::Esreg:
+            case SkLine::Type::Ipv6Address:
+                return true;
+            case SkLine::Type::Other:
+                return line.keyword.length > 1 && line.keyword.data[0] == 'E';
+            default:
+                return false;
+        }
+    }
+
+    struct Pending {
+        std::string command;
+        SkCommandResult::Terminator terminator;
+        Callback done;
+        std::shared_ptr<SkCommandResult> result;
+        uint32_t sentAt;
+    };
+
+    void pump(const uint32_t now) {
+        while (outstanding < maxOutstanding && outstanding < queue.size()) {
+            Pending &next = queue[outstanding];
+            serial_.println(next.command);
+            next.sentAt = now;
+            outstanding++;
+        }
+    }
+
+    void complete(const SkCommandResult::Status status, const uint8_t errorCode, const uint32_t now) {
+        Pending head = std::move(queue.front());
+        queue.pop_front();
+        outstanding--;
+        head.result->status    = status;
+        head.result->errorCode = errorCode;
+        if (head.done != nullptr) {
+            head.done(*head.result);
+        }
+        pump(now);
+    }
+
+    ISerialIO &serial_;
+    std::deque<Pending> queue;
+    size_t outstanding    = 0;
+    size_t maxOutstanding = 1;
+    uint32_t timeoutMs    = 5000;
+};
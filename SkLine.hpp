@@ -0,0 +1,181 @@
+#pragma once
+
+#include "Event.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+
+/// @brief SKSTACKの受信行の種別と解析済みの項目
+/// @details 受信した行を1回だけ走査して種別を決め、各項目の位置を記録する。
+///          各状態の処理は種別で分岐し、行を検索し直さない。
+///          項目は元の行を指すため、SkLineは元の行より長く保持しないこと。
+class SkLine {
+  public:
+    enum class Type : uint8_t {
+        Empty,
+        Ok,            // OK [値]
+        Fail,          // FAIL ERxx
+        Event,         // EVENT xx 送信元 [パラメータ]
+        ErxUdp,        // ERXUDP 送信元 宛先 ...
+        Einfo,         // EINFO IPv6 MAC64 チャンネル PanID MAC16
+        Ever,          // EVER バージョン
+        Esreg,         // ESREG 値
+        Epandesc,      // EPANDESC
+        EpandescField, // EPANDESCに続く "項目名:値"
+        Eedscan,       // EEDSCAN
+        Ipv6Address,   // SKLL64の応答
+        Async,         // その他の非同期通知(ERXTCP, EPONG)
+        Echo,          // コマンドのエコーバック
+        Other,         // 上記以外(EDスキャン結果などのデータ行)
+    };
+
+    /// @brief 行の一部分
+    struct Token {
+        const char *data = "";
+        size_t length    = 0;
+
+        bool operator==(const char *const s) const {
+            return strlen(s) == length && memcmp(data, s, length) == 0;
+        }
+        bool operator==(const std::string &s) const {
+            return s.length() == length && memcmp(data, s.data(), length) == 0;
+        }
+        std::string str() const {
+            return std::string(data, length);
+        }
+        unsigned long toUlong(const int base = 16) const {
+            return strtoul(data, nullptr, base);
+        }
+    };
+
+    static constexpr size_t maxTokens = 8;
+
+    Type type = Type::Empty;
+    Token keyword;                                       // 行頭の語
+    Token tokens[maxTokens];                             // キーワードに続く項目(空白区切り)
+    uint8_t tokenCount              = 0;                 // maxTokensを超えた分は数えない
+    uint8_t errorCode               = 0;                 // FAIL ERxx の xx
+    Event::Type eventType           = Event::Type::Invalid;
+    Event::Parameter eventParameter = Event::Parameter::Invalid;
+    Token key;                                           // EPANDESCの項目名
+    Token value;                                         // EPANDESCの値
+
+    SkLine() {}
+
+    /// @param line 前後の空白を取り除いた受信行
+    explicit SkLine(const std::string &line)
+        : text_(&line) {
+        classify();
+    }
+
+    const std::string &text() const {
+        return *text_;
+    }
+
+    /// @brief コマンドの応答ではない非同期の行か
+    bool isAsync() const {
+        return type == Type::Event || type == Type::ErxUdp || type == Type::Epandesc || type == Type::Eedscan || type == Type::Async;
+    }
+
+  private:
+    static bool isHex(const char c) {
+        return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f');
+    }
+
+    static bool isIpv6Address(const std::string &s) {
+        if (s.length() != 39) {
+            return false;
+        }
+        for (size_t i = 0; i < s.length(); i++) {
+            if (i % 5 == 4 ? s[i] != ':' : !isHex(s[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// @brief "Channel Page:21" のような項目名(英字と空白)と値に分ける
+    bool splitField(const char *const begin, const char *const end) {
+        const char *const colon = static_cast<const char *>(memchr(begin, ':', end - begin));
+        if (colon == nullptr || colon == begin) {
+            return false;
+        }
+        for (const char *p = begin; p < colon; p++) {
+            if (!((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') || *p == ' ')) {
+                return false;
+            }
+        }
+        const char *v = colon + 1;
+        while (v < end && *v == ' ') {
+            v++;
+        }
+        const char *k = colon;
+        while (k > begin && k[-1] == ' ') {
+            k--;
+        }
+        key   = {begin, static_cast<size_t>(k - begin)};
+        value = {v, static_cast<size_t>(end - v)};
+        return true;
+    }
+
+    void classify() {
+        const char *const begin = text_->c_str();
+        const char *const end   = begin + text_->length();
+        if (begin == end) {
+            type = Type::Empty;
+            return;
+        }
+        const char *p = static_cast<const char *>(memchr(begin, ' ', end - begin));
+        keyword       = {begin, static_cast<size_t>((p != nullptr ? p : end) - begin)};
+        p             = p != nullptr ? p : end;
+        while (p < end && tokenCount < maxTokens) {
+            if (*p == ' ') {
+                p++;
+                continue;
+            }
+            const char *next = static_cast<const char *>(memchr(p, ' ', end - p));
+            next             = next != nullptr ? next : end;
+            tokens[tokenCount++] = {p, static_cast<size_t>(next - p)};
+            p                    = next;
+        }
+
+        if (keyword == "OK") {
+            type = Type::Ok;
+        } else if (keyword == "FAIL") {
+            type      = Type::Fail;
+            errorCode = tokenCount > 0 && tokens[0].length > 2 && memcmp(tokens[0].data, "ER", 2) == 0 ? static_cast<uint8_t>(strtoul(tokens[0].data + 2, nullptr, 10)) : 0;
+        } else if (keyword == "EVENT") {
+            type      = Type::Event;
+            eventType = tokenCount > 0 ? static_cast<Event::Type>(tokens[0].toUlong()) : Event::Type::Invalid;
+            if (tokenCount > 2) {
+                eventParameter = static_cast<Event::Parameter>(tokens[2].toUlong());
+            }
+        } else if (keyword == "ERXUDP") {
+            type = Type::ErxUdp;
+        } else if (keyword == "EINFO") {
+            type = Type::Einfo;
+        } else if (keyword == "EVER") {
+            type = Type::Ever;
+        } else if (keyword == "ESREG") {
+            type = Type::Esreg;
+        } else if (keyword == "EPANDESC") {
+            type = Type::Epandesc;
+        } else if (keyword == "EEDSCAN") {
+            type = Type::Eedscan;
+        } else if (keyword == "ERXTCP" || keyword == "EPONG") {
+            type = Type::Async;
+        } else if ((keyword.length >= 2 && memcmp(begin, "SK", 2) == 0) || keyword == "ROPT" || keyword == "WOPT" || keyword == "WUART") {
+            type = Type::Echo;
+        } else if (isIpv6Address(*text_)) {
+            type = Type::Ipv6Address;
+        } else if (splitField(begin, end)) {
+            type = Type::EpandescField;
+        } else {
+            type = Type::Other;
+        }
+    }
+
+    static inline const std::string empty;
+    const std::string *text_ = &empty;
+};
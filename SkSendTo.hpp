@@ -16,7 +16,14 @@ class skSendTo {
         : length(length), destIpv6(dest) {};
     std::string getSendString() {
         char sendData[256];
-        snprintf(sendData, sizeof(sendData), "SKSENDTO %d %s %04X %d %04X ", this->udpHandle, this->destIpv6.c_str(), this->destPort, this->secured, this->length);
+        format(sendData, sizeof(sendData), this->destIpv6.c_str(), this->length, this->udpHandle, this->destPort, this->secured);
         return std::string(sendData);
     };
+
+    /// @brief 送信コマンドのデータ部より前をbufferに書き込む(ヒープを確保しない)
+    /// @return 書き込んだ文字数。bufferに収まらない場合は0
+    static size_t format(char *const buffer, const size_t size, const char *const destIpv6, const uint16_t length, const uint8_t udpHandle = 0x01, const uint16_t destPort = 0x0E1A, const uint8_t secured = 0x01) {
+        const int ret = snprintf(buffer, size, "SKSENDTO %d %s %04X %d %04X ", udpHandle, destIpv6, destPort, secured, length);
+        return ret > 0 && static_cast<size_t>(ret) < size ? static_cast<size_t>(ret) : 0;
+    }
 };
@@ -1,10 +1,14 @@
 #pragma once
 #include "ISerialIO.h"
 #include "esphome/components/uart/uart.h"
+#include <algorithm>
+#include <cstring>
 
 class UARTDeviceAdapter : public ISerialIO {
   public:
     UARTDeviceAdapter(esphome::uart::UARTDevice &uart) : uart_(uart) {}
+    /// @param component setBaudRate() でUART速度を変更する場合に指定する
+    UARTDeviceAdapter(esphome::uart::UARTDevice &uart, esphome::uart::UARTComponent *component) : uart_(uart), component_(component) {}
     virtual ~UARTDeviceAdapter() = default;
     size_t write(uint8_t data) {
         uart_.write_byte(data);
@@ -15,14 +19,21 @@ class UARTDeviceAdapter : public ISerialIO {
         return size;
     }
     virtual int read() {
+        if (!pending_.empty()) {
+            const uint8_t data = static_cast<uint8_t>(pending_.front());
+            pending_.erase(0, 1);
+            scanned_ = 0;
+            return data;
+        }
         uint8_t data;
         if (uart_.read_byte(&data)) {
             return data;
         }
         return -1;
     }
+    /// @details read() と同じく、持ち越した受信データも数える
     virtual int available() {
-        return uart_.available();
+        return uart_.available() + static_cast<int>(pending_.size());
     }
     virtual void flush() {
         uart_.flush();
@@ -36,27 +47,96 @@ class UARTDeviceAdapter : public ISerialIO {
         ret += print("\r\n");
         return ret;
     }
+    /// @brief 受信済みのデータをまとめて読み、終端までを返す
+    /// @details 終端が来ていない行は返さずに次回へ持ち越す(空文字列を返す)
     virtual std::string readStringUntil(char terminator) {
         std::string ret;
-        uint8_t data;
-        while (uart_.available()) {
-            if (uart_.peek_byte(&data) && data == terminator) {
-                uart_.read_byte(&data);
-                break;
-            }
-            if (uart_.read_byte(&data)) {
-                ret += static_cast<char>(data);
-            }
-        }
+        readLine(ret, terminator);
         return ret;
     }
+    /// @details pending_とlineの領域を使い回すため、行の長さが伸びない限りヒープを確保しない
+    virtual bool readLine(std::string &line, char terminator) {
+        const size_t length = receiveLine(terminator);
+        if (length == std::string::npos) {
+            line.clear();
+            return false;
+        }
+        line.assign(pending_, 0, length);
+        pending_.erase(0, length + 1);
+        scanned_ = 0;
+        return length > 0;
+    }
+    virtual bool setBaudRate(uint32_t baudRate) {
+        if (component_ == nullptr) {
+            return false;
+        }
+        uart_.flush();
+        component_->set_baud_rate(baudRate);
+        component_->load_settings(false);
+        pending_.clear();
+        scanned_    = 0;
+        discarding_ = false;
+        return true;
+    }
+    virtual uint32_t getBaudRate() const {
+        return component_ != nullptr ? component_->get_baud_rate() : 0;
+    }
+    virtual uint32_t getLineOverflows() const {
+        return overflows_;
+    }
     virtual size_t readBytes(uint8_t *buffer, size_t length) {
-        if (uart_.read_array(buffer, length)) {
+        const size_t carried = std::min(length, pending_.size());
+        memcpy(buffer, pending_.data(), carried);
+        pending_.erase(0, carried);
+        scanned_ = 0;
+        if (carried == length || uart_.read_array(&buffer[carried], length - carried)) {
             return length;
         }
-        return 0;
+        return carried;
     }
 
   private:
+    /// @brief 終端が来るまで受信済みのデータをpending_に読み込む
+    /// @details 終端が来ないままmaxLineLengthを超えた場合(ノイズやUART速度の不一致)は、
+    ///          pending_を捨てて次の終端までを読み飛ばす
+    /// @return 終端までの長さ。終端が来ていない場合はnpos
+    size_t receiveLine(const char terminator) {
+        while (true) {
+            const char *const end = static_cast<const char *>(memchr(pending_.data() + scanned_, terminator, pending_.size() - scanned_));
+            if (end != nullptr) {
+                const size_t length = static_cast<size_t>(end - pending_.data());
+                if (!discarding_) {
+                    return length;
+                }
+                pending_.erase(0, length + 1);
+                scanned_    = 0;
+                discarding_ = false;
+                continue;
+            }
+            scanned_ = pending_.size();
+            if (pending_.size() > maxLineLength) {
+                overflows_ += discarding_ ? 0 : 1;
+                discarding_ = true;
+                pending_.clear();
+                scanned_ = 0;
+            }
+            const int count = uart_.available();
+            if (count <= 0) {
+                return std::string::npos;
+            }
+            const size_t length = std::min(static_cast<size_t>(count), sizeof(chunk_));
+            if (!uart_.read_array(chunk_, length)) {
+                return std::string::npos;
+            }
+            pending_.append(reinterpret_cast<const char *>(chunk_), length);
+        }
+    }
+
     esphome::uart::UARTDevice &uart_;
+    esphome::uart::UARTComponent *component_ = nullptr;
+    uint8_t chunk_[64];
+    std::string pending_; // 終端がまだ来ていない受信データ
+    size_t scanned_     = 0;     // pending_のうち終端がないことを確認済みの長さ
+    bool discarding_    = false; // 上限を超えた行の残りを次の終端まで捨てている
+    uint32_t overflows_ = 0;     // 上限を超えて捨てた行の数
 };
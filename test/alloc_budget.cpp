@@ -0,0 +1,179 @@
+#include "BP35A1.hpp"
+#include "BP35A1Emulator.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <esp_timer.h>
+#include <new>
+
+/// @brief ヒープ確保の回数とバイト数の上限
+/// @details 初期化は一度きりなので少しの確保を許し、定常状態の定期取得1周期は0とする。
+///          送信時間の照合(SKSREG SFD)はコマンドエンジンの結果を確保するため別枠とする
+struct Budget {
+    const char *const name;
+    const size_t maxAllocations;
+    const size_t maxBytes;
+};
+
+static constexpr Budget initializeBudget = {"initialize", 48, 4096};
+static constexpr Budget pollCycleBudget  = {"poll cycle", 0, 0};
+static constexpr Budget reconcileBudget  = {"reconcile", 8, 1024};
+
+static bool counting      = false;
+static int excludeDepth   = 0; // エミュレータ内部の確保は数えない
+static size_t allocations = 0;
+static size_t bytes       = 0;
+
+void *operator new(size_t size) {
+    if (counting && excludeDepth == 0) {
+        allocations++;
+        bytes += size;
+    }
+    void *const p = malloc(size > 0 ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+struct Exclude {
+    Exclude() {
+        excludeDepth++;
+    }
+    ~Exclude() {
+        excludeDepth--;
+    }
+};
+
+/// @brief エミュレータの確保を数えないように包むISerialIO
+/// @details readLine() は呼び出し側の領域に書き込むため、エミュレータの領域に読んでから写す。
+///          ドライバの受信領域が伸びた場合はドライバの確保として数える
+class ExcludingSerial : public ISerialIO {
+  public:
+    explicit ExcludingSerial(BP35A1Emulator &emulator)
+        : emulator(emulator) {}
+    size_t write(uint8_t data) override {
+        Exclude e;
+        return emulator.write(data);
+    }
+    size_t write(const uint8_t *buffer, size_t size) override {
+        Exclude e;
+        return emulator.write(buffer, size);
+    }
+    int read() override {
+        Exclude e;
+        return emulator.read();
+    }
+    int available() override {
+        Exclude e;
+        return emulator.available();
+    }
+    void flush() override {
+        Exclude e;
+        emulator.flush();
+    }
+    size_t print(const std::string &data) override {
+        Exclude e;
+        return emulator.print(data);
+    }
+    size_t println(const std::string &data) override {
+        Exclude e;
+        return emulator.println(data);
+    }
+    std::string readStringUntil(char terminator) override {
+        Exclude e;
+        return emulator.readStringUntil(terminator);
+    }
+    bool readLine(std::string &line, char terminator) override {
+        bool received;
+        {
+            Exclude e;
+            received = emulator.readLine(buffer, terminator);
+        }
+        line.assign(buffer);
+        return received;
+    }
+    size_t readBytes(uint8_t *buffer, size_t length) override {
+        Exclude e;
+        return emulator.readBytes(buffer, length);
+    }
+
+  private:
+    BP35A1Emulator &emulator;
+    std::string buffer;
+};
+
+static bool check(const Budget &budget, const size_t allocations, const size_t bytes) {
+    const bool ok = allocations <= budget.maxAllocations && bytes <= budget.maxBytes;
+    printf("%-10s : %4zu allocations %6zu bytes (budget %zu / %zu) %s\n", budget.name, allocations, bytes, budget.maxAllocations, budget.maxBytes, ok ? "OK" : "EXCEEDED");
+    return ok;
+}
+
+int main() {
+    constexpr uint32_t pollPeriodMs = 10000;
+    constexpr int warmUpCycles      = 3;
+    constexpr int measuredCycles    = 30;
+
+    BP35A1Emulator::Config config;
+    config.latencyJitterMs = 0;
+    BP35A1Emulator emulator(config);
+    emulator.setClock([] { return static_cast<uint32_t>(hostTimeUs / 1000); });
+    ExcludingSerial serial(emulator);
+    BP35A1 bp35a1("ID", "PASSWORD", serial);
+    bool ok = true;
+
+    counting = true;
+    for (int i = 0; i < 20000 && !bp35a1.initializeLoop(); i++) {
+        hostTimeUs += 1000;
+    }
+    counting = false;
+    if (bp35a1.getInitializeState() != BP35A1::InitializeState::readySmartMeter) {
+        printf("initialization did not complete\n");
+        return EXIT_FAILURE;
+    }
+    ok &= check(initializeBudget, allocations, bytes);
+
+    // 1周期 = 定期取得のGet送信から次の送信まで。受信領域が伸びきるまで数周期回してから数える
+    bp35a1.schedulePropertyRequest({0xE7, 0xE8}, pollPeriodMs);
+    int responses = 0;
+    const auto callback = [&responses](const LowVoltageSmartElectricEnergyMeterClass &) { responses++; };
+    size_t maxPollAllocations = 0, maxPollBytes = 0, maxReconcileAllocations = 0, maxReconcileBytes = 0;
+    int reconciles = 0;
+    for (int cycle = 0; cycle < warmUpCycles + measuredCycles; cycle++) {
+        const uint32_t registerReads = emulator.getStats().commands.count("SKSREG") > 0 ? emulator.getStats().commands.at("SKSREG") : 0;
+        allocations = bytes = 0;
+        counting            = cycle >= warmUpCycles;
+        for (uint32_t ms = 0; ms < pollPeriodMs; ms++) {
+            hostTimeUs += 1000;
+            bp35a1.communicationLoop(callback, BP35A1::CommunicationState::ready);
+        }
+        counting = false;
+        if (cycle < warmUpCycles) {
+            continue;
+        }
+        if (emulator.getStats().commands.at("SKSREG") != registerReads) {
+            reconciles++;
+            maxReconcileAllocations = std::max(maxReconcileAllocations, allocations);
+            maxReconcileBytes       = std::max(maxReconcileBytes, bytes);
+        } else {
+            maxPollAllocations = std::max(maxPollAllocations, allocations);
+            maxPollBytes       = std::max(maxPollBytes, bytes);
+        }
+    }
+    if (responses < warmUpCycles + measuredCycles - 1) {
+        printf("only %d responses in %d cycles\n", responses, warmUpCycles + measuredCycles);
+        return EXIT_FAILURE;
+    }
+    ok &= check(pollCycleBudget, maxPollAllocations, maxPollBytes);
+    if (reconciles > 0) {
+        ok &= check(reconcileBudget, maxReconcileAllocations, maxReconcileBytes);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,92 @@
+#include "BP35A1.hpp"
+#include "BP35A1Emulator.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <esp_timer.h>
+
+/// @brief 指定したコマンドにだけ FAIL ER06(引数の誤り)を返すISerialIO
+/// @details それ以外の送受信はエミュレータにそのまま渡す
+class RejectingSerial : public ISerialIO {
+  public:
+    RejectingSerial(BP35A1Emulator &emulator, const std::string &rejected)
+        : emulator(emulator), rejected(rejected) {}
+    size_t write(uint8_t data) override {
+        return emulator.write(data);
+    }
+    size_t write(const uint8_t *buffer, size_t size) override {
+        return emulator.write(buffer, size);
+    }
+    int read() override {
+        return emulator.read();
+    }
+    int available() override {
+        return emulator.available() + static_cast<int>(injected.size());
+    }
+    void flush() override {
+        emulator.flush();
+    }
+    size_t print(const std::string &data) override {
+        return emulator.print(data);
+    }
+    size_t println(const std::string &data) override {
+        if (data.compare(0, rejected.length(), rejected) == 0) {
+            sent++;
+            injected.push_back("FAIL ER06");
+            return data.length() + 2;
+        }
+        return emulator.println(data);
+    }
+    std::string readStringUntil(char terminator) override {
+        return emulator.readStringUntil(terminator);
+    }
+    bool readLine(std::string &line, char terminator) override {
+        if (!injected.empty()) {
+            line = injected.front();
+            injected.pop_front();
+            return true;
+        }
+        return emulator.readLine(line, terminator);
+    }
+    size_t readBytes(uint8_t *buffer, size_t length) override {
+        return emulator.readBytes(buffer, length);
+    }
+
+    uint32_t sent = 0; // 拒否したコマンドの送信回数
+
+  private:
+    BP35A1Emulator &emulator;
+    const std::string rejected;
+    std::deque<std::string> injected;
+};
+
+/// @brief 引数の誤りで拒否されたコマンドを送り直さず、commandRejectedで止まることを確かめる
+int main() {
+    BP35A1Emulator::Config config;
+    BP35A1Emulator emulator(config);
+    emulator.setClock([] { return static_cast<uint32_t>(hostTimeUs / 1000); });
+    RejectingSerial serial(emulator, "SKSETPWD");
+    BP35A1 bp35a1("ID", "PASSWORD", serial);
+    int notified = 0;
+    bp35a1.setStatusChangeCallback([&notified](const BP35A1::InitializeState state) {
+        notified += state == BP35A1::InitializeState::commandRejected;
+    });
+
+    for (int i = 0; i < 60000; i++) {
+        hostTimeUs += 1000;
+        bp35a1.initializeLoop();
+    }
+
+    const Metrics &metrics = bp35a1.getMetrics();
+    const auto resets      = emulator.getStats().commands.count("SKRESET") > 0 ? emulator.getStats().commands.at("SKRESET") : 0;
+    const bool stopped     = bp35a1.getInitializeState() == BP35A1::InitializeState::commandRejected;
+    const bool ok          = stopped && notified == 1 && serial.sent == 1 && resets == 1 && metrics.get(Metrics::Counter::CommandRejections) == 1;
+    printf("stopped %d notified %d SKSETPWD %u SKRESET %u rejections %u %s\n", stopped, notified, (unsigned)serial.sent, (unsigned)resets,
+           (unsigned)metrics.get(Metrics::Counter::CommandRejections), ok ? "OK" : "FAILED");
+
+    // 設定を直して再初期化すれば、拒否されたコマンドからやり直す
+    bp35a1.initializeLoop(true);
+    const bool restarted = bp35a1.getInitializeState() != BP35A1::InitializeState::commandRejected;
+    printf("restarted %d %s\n", restarted, restarted ? "OK" : "FAILED");
+    return ok && restarted ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,112 @@
+#include "ErxUdp.hpp"
+#include "HexCodec.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// ERXUDPのデータ部のデコード時間を電文の大きさ毎に測る。
+// SWAR版(HexCodec::decode)とバイト毎の変換を比べ、結果が一致することも確かめる。
+// 通常のGet_Resと、積算電力量計測値履歴(0xE2: 30分毎48コマ)のような大きい電文を対象にする
+
+/// @brief バイト毎に変換する(比較用)
+static bool decodeScalar(const char *const src, const size_t length, uint8_t *const dst) {
+    if (length % 2 != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i += 2) {
+        const int8_t h = HexCodec::nibble(src[i]);
+        const int8_t l = HexCodec::nibble(src[i + 1]);
+        if (h < 0 || l < 0) {
+            return false;
+        }
+        dst[i / 2] = static_cast<uint8_t>((h << 4) | l);
+    }
+    return true;
+}
+
+/// @brief Get_Res電文を組み立てる(EHD TID SEOJ DEOJ ESV OPC の後に各プロパティ)
+static std::vector<uint8_t> getResponse(const std::vector<std::pair<uint8_t, uint8_t>> &properties) {
+    std::vector<uint8_t> frame = {0x10, 0x81, 0x00, 0x01, 0x02, 0x88, 0x01, 0x05, 0xFF, 0x01, 0x72, static_cast<uint8_t>(properties.size())};
+    for (const auto &property : properties) {
+        frame.push_back(property.first);
+        frame.push_back(property.second);
+        for (uint8_t i = 0; i < property.second; i++) {
+            frame.push_back(static_cast<uint8_t>(0x3C + i * 7));
+        }
+    }
+    return frame;
+}
+
+static std::string erxUdpLine(const std::vector<uint8_t> &frame) {
+    char header[160];
+    snprintf(header, sizeof(header), "ERXUDP FE80:0000:0000:0000:021D:1290:0003:0C89 FE80:0000:0000:0000:021D:1290:1234:5678 0E1A 0E1A 001D129000030C89 1 %04X ", (unsigned)frame.size());
+    std::string line = header;
+    for (const uint8_t byte : frame) {
+        char s[3];
+        snprintf(s, sizeof(s), "%02x", byte);
+        line += s;
+    }
+    return line;
+}
+
+template <class F>
+static double nanosecondsPerCall(const int iterations, F &&f) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        f();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+int main() {
+    constexpr int iterations = 200000;
+
+    struct Case {
+        const char *name;
+        std::vector<uint8_t> frame;
+    };
+    const Case cases[] = {
+        {"E7", getResponse({{0xE7, 4}})},
+        {"E7 E8", getResponse({{0xE7, 4}, {0xE8, 4}})},
+        {"E0 E3 E7 E8", getResponse({{0xE0, 4}, {0xE3, 4}, {0xE7, 4}, {0xE8, 4}})},
+        {"E2 history", getResponse({{0xE2, 2 + 48 * 4}})},
+    };
+
+    bool ok = true;
+    volatile uint8_t sink = 0;
+    printf("%-12s %6s %12s %12s %16s\n", "frame", "bytes", "scalar[ns]", "SWAR[ns]", "ERXUDP+SWAR[ns]");
+    for (const Case &c : cases) {
+        const std::string line = erxUdpLine(c.frame);
+        ErxUdp erxUdp;
+        std::vector<uint8_t> data;
+        if (!erxUdp.parse(line) || !erxUdp.decodePayload(data) || data != c.frame) {
+            printf("%-12s decode mismatch\n", c.name);
+            ok = false;
+            continue;
+        }
+        std::vector<uint8_t> scalar(c.frame.size());
+        if (!decodeScalar(erxUdp.payload.data(), erxUdp.payload.length(), scalar.data()) || scalar != c.frame) {
+            printf("%-12s scalar decode mismatch\n", c.name);
+            ok = false;
+            continue;
+        }
+        const double scalarNs = nanosecondsPerCall(iterations, [&] {
+            decodeScalar(erxUdp.payload.data(), erxUdp.payload.length(), scalar.data());
+            sink = sink + scalar[scalar.size() - 1];
+        });
+        const double swarNs = nanosecondsPerCall(iterations, [&] {
+            HexCodec::decode(erxUdp.payload.data(), erxUdp.payload.length(), data.data());
+            sink = sink + data[data.size() - 1];
+        });
+        const double lineNs = nanosecondsPerCall(iterations, [&] {
+            erxUdp.parse(line);
+            erxUdp.decodePayload(data);
+            sink = sink + data[data.size() - 1];
+        });
+        printf("%-12s %6zu %12.1f %12.1f %16.1f\n", c.name, c.frame.size(), scalarNs, swarNs, lineNs);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdio>
+
+// ホストでのテスト用。警告以上を標準エラーに出し、それ以外は書式の検査のみ行う
+#define ESP_LOGE(tag, format, ...) std::fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) std::fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) do { if (0) std::fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, format, ...) do { if (0) std::fprintf(stderr, "D %s: " format "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGV(tag, format, ...) do { if (0) std::fprintf(stderr, "V %s: " format "\n", tag, ##__VA_ARGS__); } while (0)
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+/// @brief ホストでのテスト用の仮想時刻[us]。テストが進める
+inline int64_t hostTimeUs = 0;
+
+inline int64_t esp_timer_get_time() {
+    return hostTimeUs;
+}
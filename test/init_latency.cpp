@@ -0,0 +1,49 @@
+#include "BP35A1.hpp"
+#include "BP35A1Emulator.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <esp_timer.h>
+
+/// @brief コマンドの応答時間を変えて初期化と定期取得を行い、応答の対応付けがずれないことを確かめる
+/// @details 応答がずれると前のコマンドのOKが次のコマンドの応答として扱われ、
+///          想定外の行や回復処理、同じコマンドの再送として現れる
+static bool run(const uint32_t commandLatencyMs) {
+    constexpr uint32_t pollPeriodMs = 10000;
+    constexpr int pollCycles        = 10;
+
+    BP35A1Emulator::Config config;
+    config.commandLatencyMs = commandLatencyMs;
+    BP35A1Emulator emulator(config);
+    emulator.setClock([] { return static_cast<uint32_t>(hostTimeUs / 1000); });
+    BP35A1 bp35a1("ID", "PASSWORD", emulator);
+
+    for (int i = 0; i < 60000 && !bp35a1.initializeLoop(); i++) {
+        hostTimeUs += 1000;
+    }
+    const bool initialized = bp35a1.getInitializeState() == BP35A1::InitializeState::readySmartMeter;
+
+    bp35a1.schedulePropertyRequest({0xE7}, pollPeriodMs);
+    int responses       = 0;
+    const auto callback = [&responses](const LowVoltageSmartElectricEnergyMeterClass &) { responses++; };
+    for (uint32_t ms = 0; initialized && ms < pollPeriodMs * pollCycles; ms++) {
+        hostTimeUs += 1000;
+        bp35a1.communicationLoop(callback, BP35A1::CommunicationState::ready);
+    }
+
+    const Metrics &metrics   = bp35a1.getMetrics();
+    const auto commandCount  = [&emulator](const char *const name) { return emulator.getStats().commands.count(name) > 0 ? emulator.getStats().commands.at(name) : 0; };
+    const uint32_t recovered = metrics.get(Metrics::Counter::RecoveryRetries) + metrics.get(Metrics::Counter::RecoveryRejoins) + metrics.get(Metrics::Counter::RecoveryRescans) + metrics.get(Metrics::Counter::RecoveryResets);
+    const bool ok            = initialized && responses >= pollCycles - 1 && metrics.get(Metrics::Counter::UnexpectedLines) == 0 && recovered == 0 && metrics.get(Metrics::Counter::Reinitializations) == 0 && commandCount("SKINFO") == 1 && commandCount("SKRESET") == 1;
+    printf("latency %2u ms : initialized %d responses %d unexpected %u recovered %u reinitialized %u SKINFO %u SKRESET %u %s\n",
+           (unsigned)commandLatencyMs, initialized, responses, (unsigned)metrics.get(Metrics::Counter::UnexpectedLines), (unsigned)recovered,
+           (unsigned)metrics.get(Metrics::Counter::Reinitializations), (unsigned)commandCount("SKINFO"), (unsigned)commandCount("SKRESET"), ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main() {
+    bool ok = true;
+    for (const uint32_t commandLatencyMs : {1u, 5u, 20u, 100u}) {
+        ok &= run(commandLatencyMs);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
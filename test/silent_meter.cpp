@@ -0,0 +1,28 @@
+#include "BP35A1.hpp"
+#include "BP35A1Emulator.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <esp_timer.h>
+
+/// @brief 係数・単位の取得にメータが応答しない場合に、再送だけを続けずに復旧段階を進めることを確かめる
+int main() {
+    BP35A1Emulator::Config config;
+    config.responseLossRate = 1.0f;
+    BP35A1Emulator emulator(config);
+    emulator.setClock([] { return static_cast<uint32_t>(hostTimeUs / 1000); });
+    BP35A1 bp35a1("ID", "PASSWORD", emulator);
+
+    for (int i = 0; i < 10 * 60 * 1000; i++) {
+        hostTimeUs += 1000;
+        bp35a1.initializeLoop();
+    }
+
+    const Metrics &metrics = bp35a1.getMetrics();
+    const uint32_t retries = metrics.get(Metrics::Counter::RecoveryRetries);
+    const uint32_t rejoins = metrics.get(Metrics::Counter::RecoveryRejoins);
+    const uint32_t rescans = metrics.get(Metrics::Counter::RecoveryRescans);
+    const uint32_t resets  = metrics.get(Metrics::Counter::RecoveryResets);
+    const bool ok          = bp35a1.getInitializeState() != BP35A1::InitializeState::readySmartMeter && retries > 0 && rejoins > 0 && rescans > 0 && resets > 0;
+    printf("requests %u retry %u rejoin %u rescan %u reset %u %s\n", (unsigned)emulator.getStats().requests, (unsigned)retries, (unsigned)rejoins, (unsigned)rescans, (unsigned)resets, ok ? "OK" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,48 @@
+#include "BP35A1.hpp"
+#include "BP35A1Emulator.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <esp_timer.h>
+
+/// @brief Get応答を待っている間に届いたINF(0x73)を応答として扱わないことを確かめる
+/// @details INFの通知間隔をメータの応答時間より短くし、応答待ちの間に必ずINFが届くようにする
+int main() {
+    constexpr uint32_t pollPeriodMs = 10000;
+    constexpr int pollCycles        = 20;
+
+    BP35A1Emulator::Config config;
+    config.responseLatencyMs = 500;
+    config.latencyJitterMs   = 0;
+    config.infIntervalMs     = 300;
+    BP35A1Emulator emulator(config);
+    emulator.setClock([] { return static_cast<uint32_t>(hostTimeUs / 1000); });
+    BP35A1 bp35a1("ID", "PASSWORD", emulator);
+
+    for (int i = 0; i < 60000 && !bp35a1.initializeLoop(); i++) {
+        hostTimeUs += 1000;
+    }
+    if (bp35a1.getInitializeState() != BP35A1::InitializeState::readySmartMeter) {
+        printf("initialization did not complete\n");
+        return EXIT_FAILURE;
+    }
+
+    bp35a1.schedulePropertyRequest({0xE7}, pollPeriodMs);
+    const uint32_t requestsBefore = emulator.getStats().requests;
+    int responses = 0, others = 0;
+    const auto callback = [&responses, &others](const LowVoltageSmartElectricEnergyMeterClass &echonet) {
+        const bool getRes = echonet.size() > 10 && echonet.getRawData()[10] == 0x72;
+        responses += getRes ? 1 : 0;
+        others += getRes ? 0 : 1;
+    };
+    for (uint32_t ms = 0; ms < pollPeriodMs * pollCycles; ms++) {
+        hostTimeUs += 1000;
+        bp35a1.communicationLoop(callback, BP35A1::CommunicationState::ready);
+    }
+
+    // 最後の要求は測定終了時に応答待ちでもよい
+    const uint32_t requests = emulator.getStats().requests - requestsBefore;
+    const bool ok           = others == 0 && responses >= pollCycles - 1 && requests <= static_cast<uint32_t>(responses) + 1 && emulator.getStats().infNotifications > 0;
+    printf("requests %u responses %d others %d inf %u unexpected %u %s\n", (unsigned)requests, responses, others, (unsigned)emulator.getStats().infNotifications,
+           (unsigned)bp35a1.getMetrics().get(Metrics::Counter::UnexpectedLines), ok ? "OK" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}